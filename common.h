@@ -4,6 +4,15 @@
 ** determined by the presence of the macro QSIMPLE defined in qfind-s.c.
 */
 
+/* POSIX shared memory is used for --enable-shared-table, and fork() for */
+/* --portfolio, where available.                                         */
+#if defined(__unix__) || defined(__APPLE__)
+   #ifndef _POSIX_C_SOURCE
+      #define _POSIX_C_SOURCE 200809L
+   #endif
+   #define SHAREDTABLE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,11 +20,22 @@
 #include <time.h>
 #include <stdatomic.h>
 
+#ifdef SHAREDTABLE
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <sys/wait.h>
+   #include <unistd.h>
+   #include <poll.h>
+   #include <signal.h>
+#endif
+
 #ifdef _OPENMP
    #include <omp.h>
 #else
    #define omp_get_thread_num() 0
    #define omp_get_num_procs() 2
+   #define omp_get_num_threads() 1
    #define omp_set_num_threads(x)
 #endif
 
@@ -28,13 +48,15 @@
 #define STR(x) #x
 #define XSTR(x) STR(x)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #define BANNER XSTR(WHICHPROGRAM)" v2.4b by Matthias Merzenich, 8 September 2025"
 
-#define FILEVERSION ((unsigned long) 2025090401)  /* yyyymmddnn */
+#define FILEVERSION ((unsigned long) 2026101816)  /* yyyymmddnn */
 
 #define MAXPERIOD 30
 #define MAXDUMPROOT 50     /* maximum allowed length of dump root */
+#define PORTFOLIOMAX 6     /* maximum number of searches in a portfolio */
 #define DUMPLIMIT 100000   /* maximum allowed number of sequential dumps */
 #define CHUNK_SIZE 1
 #define QBITS 15
@@ -46,7 +68,7 @@
 #define P_PERIOD 1
 #define P_OFFSET 2
 #define P_SYMMETRY 3
-#define P_REORDER 4           /* currently cannot be set at runtime */
+#define P_REORDER 4
 #define P_DUMPMODE 5
 #define P_BASEBITS 6
 #define P_QBITS 7
@@ -66,8 +88,35 @@
 #define P_DUMPINTERVAL 21
 #define P_EVERYDEPTH 22
 #define P_EARLYEXIT 23
-
-#define NUM_PARAMS 24U
+#define P_WORKSTEAL 24
+#define P_MEMOBITS 25
+#define P_ADAPTDEEP 26
+#define P_SPECULATE 27
+#define P_SPILL 28
+#define P_EXTBFS 29
+#define P_MEMBUDGET 30
+#define P_EVICT 31
+#define P_SHAREDTABLE 32
+#define P_BRANCH 33
+#define P_BESTFIRST 34
+#define P_IDDFS 35
+#define P_PORTFOLIO 36
+#define P_PRUNESUB 37
+
+#define NUM_PARAMS 38U
+
+#define ORDER_NATURAL 0       /* values of params[P_REORDER] */
+#define ORDER_STATS 1
+#define ORDER_POPCOUNT 2
+#define ORDER_ADAPTIVE 3
+
+#define BRANCH_TABLE 0        /* values of params[P_BRANCH] */
+#define BRANCH_FEWEST 1
+#define BRANCH_MOST 2
+
+#define BEST_OFF 0            /* values of params[P_BESTFIRST] */
+#define BEST_DEPTH 1
+#define BEST_WIDTH 2
 
 #define SYM_UNDEF 0
 #define SYM_ASYM 1
@@ -98,6 +147,7 @@ int aborting = 0;       /* A flag to indicate that we are stopping the search.
                         **   1: fatal error
                         **   2: queue size limit reached
                         **   3: desired number of ships found
+                        **   4: stopped by a signal
                         */
 
 int gutterSkew = 0;     /* number of cells to skew halves in gutter symmetric search */
@@ -118,12 +168,40 @@ node * base;
 node * hash;
 
 int nttable[512];
-_Atomic(uint16_t*) *gInd3;
+_Atomic uint32_t *gInd3;
 uint32_t *gcount;
 uint16_t *gRows;
-long long memusage = 0;
 long long memlimit = 0;
 
+/* Memory in use by each part of the search.  The total is what -m limits. */
+enum {MEM_QUEUE, MEM_HASH, MEM_EXTENSIONS, MEM_TABLES, MEM_CACHE, MEM_OTHER, NUM_MEMKINDS};
+const char *memKindName[NUM_MEMKINDS] = {"queue", "hash", "extensions", "lookup tables", "cache", "other"};
+_Atomic long long memUsed[NUM_MEMKINDS];
+
+static inline void trackMemory(int kind, long long bytes) {
+   atomic_fetch_add_explicit(&memUsed[kind], bytes, memory_order_relaxed);
+}
+
+long long memoryInUse(void) {
+   long long total = 0;
+   int k;
+   for (k = 0; k < NUM_MEMKINDS; ++k)
+      total += atomic_load_explicit(&memUsed[k], memory_order_relaxed);
+   return total;
+}
+
+static inline int overMemoryLimit(void) {
+   return params[P_MEMLIMIT] >= 0 && memoryInUse() > memlimit;
+}
+
+void printMemory(void);
+
+static double wallClock(void){
+   struct timespec ts;
+   timespec_get(&ts, TIME_UTC);
+   return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
 row **deepRows = 0;
 uint32_t *deepRowIndices;
 uint32_t deepQHead, deepQTail, oldDeepQHead;
@@ -471,36 +549,154 @@ int evolveRowLow(int row1, int row2, int row3, int bits) {
 ** added in the search.  The idea is that certain search
 ** orders give slightly quicker solutions during depthFirst()
 ** and LookAhead() than the naive order.
+**
+** Rows are sorted by decreasing gcount with a stable merge sort, so
+** rows with equal counts keep their order.
 */
-void sortRows(uint16_t *theRow, uint32_t totalRows) {
-   uint32_t i;
-   int64_t j;
-   uint16_t t;
-   for (i = 1; i < totalRows; ++i){
-      t = theRow[i];
-      j = i - 1;
-      while (j >= 0 && gcount[theRow[j]] < gcount[t]){
-         theRow[j+1] = theRow[j];
-         --j;
+
+/* Stable sort of theRow by decreasing key[], using tmp as scratch space */
+/* of at least totalRows entries.  Short lists get an insertion sort.    */
+void sortRowsBy(uint16_t *theRow, uint32_t totalRows, const uint32_t *key, uint16_t *tmp) {
+   uint16_t *src = theRow;
+   uint16_t *dst = tmp;
+   uint32_t run, lo, i, j, k;
+   if (totalRows <= 16){
+      for (i = 1; i < totalRows; ++i){
+         uint16_t t = theRow[i];
+         for (j = i; j > 0 && key[theRow[j-1]] < key[t]; --j)
+            theRow[j] = theRow[j-1];
+         theRow[j] = t;
       }
-      theRow[j+1] = t;
+      return;
+   }
+   for (run = 1; run < totalRows; run *= 2){
+      for (lo = 0; lo < totalRows; lo += 2 * run){
+         uint32_t mid = MIN(lo + run, totalRows);
+         uint32_t hi = MIN(lo + 2 * run, totalRows);
+         for (i = lo, j = mid, k = lo; i < mid && j < hi; ++k)
+            dst[k] = (key[src[j]] > key[src[i]]) ? src[j++] : src[i++];
+         while (i < mid) dst[k++] = src[i++];
+         while (j < hi) dst[k++] = src[j++];
+      }
+      uint16_t *t = src;
+      src = dst;
+      dst = t;
+   }
+   if (src != theRow)
+      memcpy(theRow, src, totalRows * sizeof(*theRow));
+}
+
+void sortRows(uint16_t *theRow, uint32_t totalRows) {
+   uint16_t *tmp = (uint16_t *)malloc(totalRows * sizeof(*tmp));
+   if (tmp == 0){
+      fprintf(stderr, "Error: unable to allocate memory for row ordering.\n");
+      exit(1);
    }
+   sortRowsBy(theRow, totalRows, gcount, tmp);
+   free(tmp);
 }
 
-uint16_t *makeRow(int row1, int row2);
+uint32_t makeRow(int row1, int row2);
+
+/* The lookup table is kept in segments of 2^tableSegBits entries which
+** never move once allocated.  gInd3[row12] holds the offset of the part
+** of the table for row12, with the segment number in the high bits, or 0
+** if that part has not been built yet.  Offset 0 is never given out.
+** When the table may be evicted, offsets stay below 2^31 and the top bit
+** marks a part that has not been used since the last eviction.
+*/
+int tableSegBits;
+uint32_t tableSegMax;            /* length of tableSegs */
+uint16_t **tableSegs = 0;
+uint32_t numTableSegs = 0;
+
+#define TABLEROW(off) (tableSegs[(off) >> tableSegBits] + ((off) & ((1U << tableSegBits) - 1)))
+
+#define TABLECOLD 0x80000000U
+int tableEvictable = 0;
 
 /* getoffset() returns a pointer to a lookup table where further information */
 /* is found.  It is used in getoffsetcount() and in lookAhead().             */
 uint16_t *getoffset(int row12) {
-   uint16_t *r = atomic_load_explicit(&gInd3[row12], memory_order_relaxed);
-   if (r == 0)
+   uint32_t r = atomic_load_explicit(&gInd3[row12], memory_order_acquire);
+   /* a part that is missing or marked cold goes through makeRow() */
+   if ((int32_t)r <= 0)
       r = makeRow(row12 >> width, row12 & ((1 << width) - 1));
-   return r;
+   return TABLEROW(r);
 }
 uint16_t *getoffset2(int row1, int row2) {
    return getoffset((row1 << width) + row2);
 }
 
+/* A part of the lookup table is stored in one of two forms.
+**
+** Dense:  theRow[row3] is the start of the list for row3 and
+**         theRow[row3+1] its end, for every row3, so theRow[0] is
+**         always 1 + 2^width.  The lists follow.
+** Sparse: theRow[0] is the number m < 1 + 2^width of rows with a
+**         nonempty list, theRow[1..m] are those rows in increasing
+**         order, theRow[m+1..2m+1] are the starts of their lists
+**         followed by the end of the last one, then a bitmap of the
+**         rows with a nonempty list in SPARSEBITMAP words, and the
+**         lists follow.  The bitmap answers hasSuccessors(), which
+**         lookAhead() calls far more often than getoffsetcount().
+**
+** The sparse form saves most of the 2^width entries for pairs with few
+** successors, but every lookup in it is slower.  So makeRow() only uses
+** it when memory is limited (-m or --memory-budget), and then when it is
+** at most half the size.  Sparse parts start at odd offsets and dense
+** parts at even ones, so the form is known from the address without
+** reading another cache line.  Segments are allocated with at least
+** 4-byte alignment.
+*/
+int sparseTable = 0;    /* set if makeRow() may use the sparse form */
+#define DENSEROW(theRow) (!sparseTable || ((uintptr_t)(theRow) & 2) == 0)
+#define SPARSEBITMAP (((1 << width) + 15) >> 4)
+
+/* number of entries in a part of the lookup table */
+static inline int tableRowSize(const uint16_t *theRow) {
+   return DENSEROW(theRow) ? theRow[1<<width] : theRow[2*theRow[0]+1];
+}
+
+/* Position of row3 among the rows with a list in a sparse part */
+static inline int sparseIndex(const uint16_t *theRow, int row3) {
+   int lo = 0, hi = theRow[0];
+   while (lo < hi){
+      int mid = (lo + hi) >> 1;
+      if (theRow[1 + mid] < row3) lo = mid + 1;
+      else hi = mid;
+   }
+   return lo;
+}
+
+/* Is the list for row3 in this part of the lookup table nonempty? */
+static inline int hasSuccessors(const uint16_t *theRow, int row3) {
+   if (DENSEROW(theRow)) return theRow[row3+1] != theRow[row3];
+   return (theRow[2 + 2*theRow[0] + (row3 >> 4)] >> (row3 & 15)) & 1;
+}
+
+/* The list for row3 in a sparse part.  This is kept out of the dense */
+/* path of partCount() and getoffsetcount(), which are inlined in the */
+/* search loops.                                                      */
+void sparseOffsetCount(uint16_t *theRow, int row3, uint16_t **p, int *n) {
+   /* an empty list points where the list would start, as in the dense form */
+   int m = theRow[0];
+   int i = sparseIndex(theRow, row3);
+   uint16_t *starts = theRow + 1 + m;
+   *p = theRow + starts[i];
+   *n = (i < m && theRow[1 + i] == row3) ? starts[i+1] - starts[i] : 0;
+}
+
+/* Number of rows in the list for row3 in this part of the lookup table */
+static inline int partCount(const uint16_t *theRow, int row3) {
+   if (DENSEROW(theRow)) return theRow[row3+1] - theRow[row3];
+   if (!hasSuccessors(theRow, row3)) return 0;
+   uint16_t *p;
+   int n;
+   sparseOffsetCount((uint16_t *)theRow, row3, &p, &n);
+   return n;
+}
+
 /* Given rows row1, row2, and row3, getoffsetcount() gives the     *\
 ** location (p) in the lookup table containing rows XXXX such that **
 **                                                                 **
@@ -511,84 +707,580 @@ uint16_t *getoffset2(int row1, int row2) {
 \* as well as the number (n) of such rows.                         */
 void getoffsetcount(int row1, int row2, int row3, uint16_t** p, int *n) {
    uint16_t *theRow = getoffset2(row1, row2);
-   *p = theRow + theRow[row3];
-   *n = theRow[row3+1] - theRow[row3];
+   if (DENSEROW(theRow)){
+      *p = theRow + theRow[row3];
+      *n = theRow[row3+1] - theRow[row3];
+      return;
+   }
+   sparseOffsetCount(theRow, row3, p, n);
 }
 
-/* Like getoffsetcount(), but only gives the number of rows.  Currently unused. */
+/* Like getoffsetcount(), but only gives the number of rows.  orderBranches() */
+/* uses partCount() directly, since it counts many lists of one part.       */
 int getcount(int row1, int row2, int row3) {
-   uint16_t *theRow = getoffset2(row1, row2);
-   return theRow[row3+1] - theRow[row3];
+   return partCount(getoffset2(row1, row2), row3);
 }
 
 uint8_t *causesBirth;
 row *flip;
 int *gWorkConcat;       /* gWorkConcat to be parceled out between threads */
-int *rowHash;
+uint32_t *rowHash;        /* offsets of the distinct parts of the lookup table */
+uint32_t rowHashMask, rowHashCount;
 uint16_t *valorder;
 void genStatCounts(void);
 
 void makeFlip(void) {
-	row theRow;
-	int i;
-	for (theRow = 0; theRow < (1<<width); theRow++) {
+	#pragma omp parallel for schedule(static)
+	for (int theRow = 0; theRow < (1<<width); theRow++) {
 		row flippedRow = 0;
-		for (i = 0; i < width; i++)
+		for (int i = 0; i < width; i++)
 			if (theRow & (1<<i))
 				flippedRow |= 1 << (width - i - 1);
 		flip[theRow] = flippedRow;
 	}
 }
 
+/* ============================== */
+/*  Shared lookup table           */
+/* ============================== */
+
+/* With --enable-shared-table, qfind processes on one machine that need the
+** same lookup table (same rule, width, symmetry and row order) use a single
+** copy of it kept in a POSIX shared memory object.  The object holds a
+** header, gInd3, a hash of the distinct parts of the table that does not
+** grow, and an arena the size of all segments, each mapped at once at
+** startup.  Memory is only allocated as pages are first written.
+**
+** A part is built in memory private to the thread and then appended to
+** the arena with an atomic add.  It is published in the hash and in gInd3
+** with compare-and-swap operations, so no lock is held across processes
+** and a process that stops cannot block the others.  When two processes
+** build the same part at once one copy is wasted.
+**
+** Each process attached holds a read lock on the object, which the system
+** drops when the process ends however it ends.  A process that detaches and
+** can then take the write lock is the last one, and removes the object.  An
+** object left behind by a process that was killed is reused by the next
+** search and removed by the last process to detach from it, and one whose
+** creator was killed before setting it up is removed and made again.
+** SIGINT, SIGTERM, SIGHUP and SIGPIPE only stop the search, so that the
+** table is detached by exit() as usual; a second signal other than SIGPIPE
+** is not caught.
+*/
+typedef struct {
+   unsigned long version;
+   int width, symmetry, boundarySym, gutterSkew, reorder, sparse;
+   int8_t rule[512];
+} sharedTableKey;
+
+typedef struct {
+   _Atomic uint32_t ready;       /* SHAREDREADY once the creator is done */
+   _Atomic uint64_t next;        /* offset of the next free arena entry */
+   sharedTableKey key;
+} sharedTableHeader;
+
+#define SHAREDREADY 0x71666e64U
+#define SHAREDHEADERSIZE 4096     /* keeps gInd3 page aligned */
+
+sharedTableHeader *sharedTable = 0;
+_Atomic uint32_t *sharedHash;    /* offsets of the distinct parts, or 0 */
+uint32_t sharedHashMask;
+uint64_t sharedArenaSize;        /* entries in the arena */
+size_t sharedMapSize;
+char sharedTableName[32];
+int sharedFd = -1;               /* holds the read lock while attached */
+uint16_t *gRowScratch;           /* parts built by each thread before publishing */
+_Atomic int *deepenStop = 0;     /* set while deepen() runs, to end it early */
+
+#ifdef SHAREDTABLE
+/* Lock the whole object: F_RDLCK while attached, F_WRLCK to find out */
+/* whether any other process is.                                    */
+static int lockSharedTable(int fd, short type, int wait) {
+   struct flock l;
+   memset(&l, 0, sizeof(l));
+   l.l_type = type;
+   l.l_whence = SEEK_SET;
+   return fcntl(fd, wait ? F_SETLKW : F_SETLK, &l);
+}
+
+/* Remove the object if it is still the one under our name */
+static void unlinkSharedTable(int ours) {
+   struct stat a, b;
+   int fd = shm_open(sharedTableName, O_RDONLY, 0);
+   if (fd < 0) return;
+   if (fstat(ours, &a) == 0 && fstat(fd, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+      shm_unlink(sharedTableName);
+   close(fd);
+}
+
+void detachSharedTable(void) {
+   if (sharedTable == 0) return;
+   munmap((void *)sharedTable, sharedMapSize);
+   sharedTable = 0;
+   if (lockSharedTable(sharedFd, F_WRLCK, 0) == 0)
+      unlinkSharedTable(sharedFd);
+   close(sharedFd);
+   sharedFd = -1;
+}
+
+static void sharedTableSignal(int sig) {
+   (void)sig;
+   aborting = 4;
+   if (deepenStop) atomic_store_explicit(deepenStop, 1, memory_order_relaxed);
+}
+
+/* Attach to the shared lookup table for this search, creating it if no */
+/* other process has, and point gInd3 and tableSegs into it.            */
+void attachSharedTable(void) {
+   sharedTableKey key;
+   unsigned int h = 2166136261U;
+   size_t i;
+   int fd, created = 1;
+   
+   memset(&key, 0, sizeof(key));
+   key.version = FILEVERSION;
+   key.width = width;
+   key.symmetry = params[P_SYMMETRY];
+   key.boundarySym = params[P_BOUNDARYSYM];
+   key.gutterSkew = gutterSkew;
+   key.reorder = params[P_REORDER];
+   key.sparse = sparseTable;
+   memcpy(key.rule, nttable2, sizeof(key.rule));
+   for (i = 0; i < sizeof(key); ++i)
+      h = (h ^ ((unsigned char *)&key)[i]) * 16777619U;
+   sprintf(sharedTableName, "/qfind-%08x", h);
+   
+   size_t indexBytes = sizeof(*gInd3) << (2 * width);
+   sharedHashMask = (2U << (2 * width)) - 1;
+   sharedArenaSize = (uint64_t)tableSegMax << tableSegBits;
+   sharedMapSize = SHAREDHEADERSIZE + indexBytes + (sharedHashMask + 1LL) * sizeof(*sharedHash)
+                   + sharedArenaSize * sizeof(uint16_t);
+   
+retry:
+   created = 1;
+   fd = shm_open(sharedTableName, O_RDWR | O_CREAT | O_EXCL, 0600);
+   if (fd < 0){
+      created = 0;
+      fd = shm_open(sharedTableName, O_RDWR, 0600);
+   }
+   if (fd < 0 || lockSharedTable(fd, F_RDLCK, 1) != 0){
+      fprintf(stderr, "Error: unable to open shared lookup table %s.\n", sharedTableName);
+      exit(1);
+   }
+   if (created){
+      if (ftruncate(fd, (off_t)sharedMapSize) != 0){
+         fprintf(stderr, "Error: unable to allocate shared lookup table %s.\n", sharedTableName);
+         shm_unlink(sharedTableName);
+         exit(1);
+      }
+   }
+   else {
+      /* wait for the creator to set the size */
+      struct stat st;
+      struct timespec pause = {0, 10000000};
+      for (i = 0; i < 1000; ++i){
+         if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sharedMapSize) break;
+         nanosleep(&pause, 0);
+      }
+   }
+   sharedTable = (sharedTableHeader *)mmap(0, sharedMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (sharedTable == MAP_FAILED){
+      sharedTable = 0;
+      fprintf(stderr, "Error: unable to map shared lookup table %s.\n", sharedTableName);
+      if (created) shm_unlink(sharedTableName);
+      exit(1);
+   }
+   
+   /* a new object is all zeros: nothing built and the hash empty */
+   if (created){
+      sharedTable->key = key;
+      atomic_store(&sharedTable->next, 1);      /* offset 0 means "not built" */
+      atomic_store_explicit(&sharedTable->ready, SHAREDREADY, memory_order_release);
+   }
+   else {
+      struct timespec pause = {0, 10000000};
+      for (i = 0; i < 1000; ++i){
+         if (atomic_load_explicit(&sharedTable->ready, memory_order_acquire) == SHAREDREADY) break;
+         nanosleep(&pause, 0);
+      }
+      if (i == 1000){
+         /* a creator still attached is only slow; one that has gone was killed */
+         if (lockSharedTable(fd, F_WRLCK, 0) != 0){
+            fprintf(stderr, "Error: shared lookup table %s was never set up.\n", sharedTableName);
+            exit(1);
+         }
+         munmap((void *)sharedTable, sharedMapSize);
+         sharedTable = 0;
+         unlinkSharedTable(fd);
+         close(fd);
+         goto retry;
+      }
+      if (memcmp(&sharedTable->key, &key, sizeof(key)) != 0){
+         fprintf(stderr, "Error: shared lookup table %s belongs to a different search.\n"
+                         "       Remove /dev/shm%s and try again.\n", sharedTableName, sharedTableName);
+         exit(1);
+      }
+   }
+   sharedFd = fd;
+   atexit(detachSharedTable);
+   
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = sharedTableSignal;
+   sa.sa_flags = SA_RESETHAND;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, 0);
+   sigaction(SIGTERM, &sa, 0);
+   sigaction(SIGHUP, &sa, 0);
+   sa.sa_flags = 0;        /* writes go on failing while the search stops */
+   sigaction(SIGPIPE, &sa, 0);
+   
+   gInd3 = (_Atomic uint32_t *)((char *)sharedTable + SHAREDHEADERSIZE);
+   sharedHash = (_Atomic uint32_t *)((char *)gInd3 + indexBytes);
+   uint16_t *arena = (uint16_t *)(sharedHash + sharedHashMask + 1);
+   for (i = 0; i < tableSegMax; ++i)
+      tableSegs[i] = arena + ((size_t)i << tableSegBits);
+   
+   gRowScratch = (uint16_t *)calloc((size_t)params[P_NUMTHREADS] * ((2 << width) + 2), sizeof(uint16_t));
+   if (gRowScratch == 0){
+      fprintf(stderr, "Error: unable to allocate memory for lookup table.\n");
+      exit(1);
+   }
+   trackMemory(MEM_TABLES, indexBytes + (sharedHashMask + 1LL) * sizeof(*sharedHash));
+   trackMemory(MEM_TABLES, (2LL * params[P_NUMTHREADS] * sizeof(uint16_t)) << width);
+   
+   timeStamp();
+   printf("%s shared lookup table %s (%" PRIu64 " entries in use)\n",
+          created ? "Created" : "Attached to", sharedTableName,
+          (uint64_t)atomic_load(&sharedTable->next) - 1);
+}
+#else
+void attachSharedTable(void) {
+   fprintf(stderr, "Error: shared lookup tables are not supported on this system.\n");
+   exit(1);
+}
+#endif
+
+/* Take siz entries from the arena of the shared lookup table, */
+/* starting at an odd offset if odd is set, as bmalloc() does.  */
+uint32_t sharedAlloc(int siz, int odd) {
+   uint64_t r = atomic_fetch_add_explicit(&sharedTable->next, (uint64_t)siz + 1, memory_order_relaxed);
+   if ((int)(r & 1) != odd) ++r;
+   if (r + siz > sharedArenaSize){
+      fprintf(stderr, "Error: shared lookup table is too large for 32-bit offsets.\n");
+      exit(1);
+   }
+   trackMemory(MEM_TABLES, 2LL * (siz + 1));
+   if (overMemoryLimit()){
+      printMemory();
+      printf("Aborting due to excessive memory usage\n");
+      exit(1);
+   }
+   return (uint32_t)r;
+}
+
+unsigned int hashRow(uint16_t *theRow, int siz);
+
+/* Publish theRow, of siz entries and built outside the table, as the   */
+/* part of the shared lookup table for row12, using an identical part if */
+/* one exists.  Needs no lock.                                           */
+uint32_t publishSharedRow(int row12, uint16_t *theRow, int siz, int sparse) {
+   unsigned int h = hashRow(theRow, siz) & sharedHashMask;
+   uint32_t off = 0, other;
+   while (1) {
+      other = atomic_load_explicit(&sharedHash[h], memory_order_acquire);
+      if (other == 0) {
+         if (off == 0) {
+            off = sharedAlloc(siz, sparse);
+            memcpy(TABLEROW(off), theRow, 2*siz);
+         }
+         if (atomic_compare_exchange_strong_explicit(&sharedHash[h], &other, off,
+                                                     memory_order_release, memory_order_acquire))
+            break;
+      }
+      uint16_t *p = TABLEROW(other);
+      if (tableRowSize(p) == siz && memcmp(p, theRow, 2*siz) == 0) {
+         off = other;      /* any copy of our own is left unused */
+         break;
+      }
+      h = (h + 1) & sharedHashMask;
+   }
+   
+   /* another process may have built the part for row12 meanwhile */
+   other = 0;
+   if (!atomic_compare_exchange_strong_explicit(&gInd3[row12], &other, off,
+                                                memory_order_release, memory_order_acquire))
+      off = other;
+   return off;
+}
+
+/* time spent in each stage of makeTables(), reported at startup */
+#define NUM_SETUPSTAGES 5
+double setupTimes[NUM_SETUPSTAGES];
+const char *setupStageName[NUM_SETUPSTAGES] = {"allocation", "row statistics", "row order", "lookup table", "total"};
+
+/* ============================== */
+/*  Adaptive row order            */
+/* ============================== */
+
+/* With --row-order adaptive, every depth-first search that reaches the
+** full deepening depth credits each row on its path.  Once the credits
+** reach four per row, reorderRows() sorts valorder by them at the end of
+** the deepening step and sorts every list of the lookup table into the
+** new order in place.  The lists keep their places in each part, so gInd3
+** and the lookahead cache stay valid, but rowHash is rebuilt since the
+** parts have changed.
+**
+** Saved extensions rely on the list order: the rows before a saved row
+** have already been searched.  Extensions saved under the old order are
+** flagged EXT_STALE.  Their searches still resume from the end of the
+** saved path, but try every row again at each level on the way back, and
+** process() tries every row beside the one the extension continues with.
+** An extension found by such a search stays stale unless the search has
+** backed up to its first row.  Since that repeats work, the order is only
+** learned once.  Dumps hold the learned order and the stale flags, so a
+** resumed search builds its lookup table in that order from the start.
+*/
+uint32_t *rowCredit = 0;         /* credits of each row, per thread */
+uint16_t *loadedOrder = 0;       /* learned order read from a dump */
+
+void allocRowCredit(void) {
+   rowCredit = (uint32_t *)calloc((size_t)params[P_NUMTHREADS] << width, sizeof(*rowCredit));
+   if (rowCredit == 0){
+      fprintf(stderr, "Error: unable to allocate memory for adaptive row order.\n");
+      exit(1);
+   }
+   trackMemory(MEM_TABLES, ((long long)params[P_NUMTHREADS] * sizeof(*rowCredit)) << width);
+}
+
+/* Credit the n rows of a successful depth-first search */
+static inline void creditRows(const row *r, int n) {
+   uint32_t *c = rowCredit + ((size_t)omp_get_thread_num() << width);
+   for (int i = 0; i < n; ++i)
+      ++c[r[i]];
+}
+
+void markStaleExtensions(void);
+
+void reorderRows(void) {
+   uint32_t n = 1U << width, i;
+   long long rowCredits = 0;
+   int t;
+   
+   /* add the credits of the other threads to those of thread 0 */
+   for (i = 0; i < n; ++i){
+      for (t = 1; t < params[P_NUMTHREADS]; ++t){
+         rowCredit[i] += rowCredit[((size_t)t << width) + i];
+         rowCredit[((size_t)t << width) + i] = 0;
+      }
+      rowCredits += rowCredit[i];
+   }
+   if (rowCredits < 4LL << width) return;
+   
+   uint16_t *order = (uint16_t *)malloc(2 * n * sizeof(*order));
+   uint32_t *rank = (uint32_t *)malloc(n * sizeof(*rank));
+   uint32_t *parts = (uint32_t *)malloc((rowHashCount + 1) * sizeof(*parts));
+   if (order == 0 || rank == 0 || parts == 0){
+      fprintf(stderr, "Error: unable to allocate memory for adaptive row order.\n");
+      exit(1);
+   }
+   rowCredit[0] = UINT32_MAX;   /* the empty row stays first */
+   memcpy(order, valorder, n * sizeof(*order));
+   sortRowsBy(order, n, rowCredit, order + n);
+   free(rowCredit);
+   rowCredit = 0;
+   trackMemory(MEM_TABLES, -(((long long)params[P_NUMTHREADS] * sizeof(*rowCredit)) << width));
+   
+   timeStamp();
+   if (memcmp(order, valorder, n * sizeof(*order)) == 0){
+      printf("Row order kept after %lld credits\n", rowCredits);
+      fflush(stdout);
+      free(order);
+      free(rank);
+      free(parts);
+      return;
+   }
+   memcpy(valorder, order, n * sizeof(*order));
+   for (i = 0; i < n; ++i)
+      rank[valorder[i]] = n - i;
+   
+   /* sort the lists of every distinct part, then rebuild rowHash */
+   uint32_t numParts = 0;
+   for (i = 0; i <= rowHashMask; ++i)
+      if (rowHash[i]) parts[numParts++] = rowHash[i];
+   double start = wallClock();
+   #pragma omp parallel
+   {
+      uint16_t *tmp = (uint16_t *)malloc(n * sizeof(*tmp));
+      long long k;
+      #pragma omp for schedule(dynamic, 256)
+      for (k = 0; k < numParts; ++k){
+         uint16_t *theRow = TABLEROW(parts[k]);
+         uint16_t *starts = theRow;
+         uint32_t lists = n;
+         if (!DENSEROW(theRow)){
+            starts = theRow + 1 + theRow[0];
+            lists = theRow[0];
+         }
+         for (uint32_t j = 0; j < lists; ++j)
+            if (starts[j+1] - starts[j] > 1)
+               sortRowsBy(theRow + starts[j], starts[j+1] - starts[j], rank, tmp);
+      }
+      free(tmp);
+   }
+   memset(rowHash, 0, (rowHashMask + 1) * sizeof(*rowHash));
+   for (i = 0; i < numParts; ++i){
+      uint16_t *theRow = TABLEROW(parts[i]);
+      unsigned int h = hashRow(theRow, tableRowSize(theRow)) & rowHashMask;
+      while (rowHash[h]) h = (h + 1) & rowHashMask;
+      rowHash[h] = parts[i];
+   }
+   markStaleExtensions();
+   
+   printf("Row order adapted after %lld credits, %u parts of the lookup table reordered in %.2fs\n",
+          rowCredits, numParts, wallClock() - start);
+   fflush(stdout);
+   free(order);
+   free(rank);
+   free(parts);
+}
+
 void makeTables(void) {
+   double start = wallClock(), t;
    flip = (row*)malloc(sizeof(*flip)<<width);
    makeFlip();
    causesBirth = (uint8_t*)calloc(1LL<<width, sizeof(*causesBirth));
-   gInd3 = (_Atomic(uint16_t*) *)calloc(1LL<<(width*2), sizeof(*gInd3));
-   rowHash = (int *)calloc(2LL<<(width*2), sizeof(*rowHash));
-   for (long long i=0; i<1LL<<(2*width); i++)
-      atomic_init(&gInd3[i], NULL);
-   for (long long i=0; i<2LL<<(2*width); i++)
-      rowHash[i] = -1;
+   
+   /* segments must hold the longest part of the table, 1+2^(width+1) */
+   /* entries, and there is no need for more than 2^(width+1) of them */
+   tableSegBits = MAX(2 * width, width + 2);
+   /* the shared table cannot be evicted, since other processes use it */
+   tableEvictable = params[P_EVICT] && params[P_MEMLIMIT] >= 0 && !params[P_SHAREDTABLE];
+   tableSegMax = (uint32_t) MIN(1LL << (32 - tableEvictable - tableSegBits), (2LL << width) + 2);
+   sparseTable = params[P_MEMLIMIT] >= 0 || params[P_MEMBUDGET] > 0;
+   tableSegs = (uint16_t **)calloc(tableSegMax, sizeof(*tableSegs));
+   if (tableSegs == 0){
+      fprintf(stderr, "Error: unable to allocate memory for lookup table.\n");
+      exit(1);
+   }
+   if (params[P_SHAREDTABLE])
+      attachSharedTable();
+   else {
+      gInd3 = (_Atomic uint32_t *)calloc(1LL<<(width*2), sizeof(*gInd3));
+      rowHashMask = (4U << width) - 1;
+      rowHashCount = 0;
+      rowHash = (uint32_t *)calloc(rowHashMask + 1, sizeof(*rowHash));
+      /* calloc() already gives zero offsets, and leaves the pages of gInd3 */
+      /* unused until they are written                                     */
+      if (gInd3 == 0 || rowHash == 0){
+         fprintf(stderr, "Error: unable to allocate memory for lookup table.\n");
+         exit(1);
+      }
+      trackMemory(MEM_TABLES, sizeof(*gInd3) << (width*2));
+      trackMemory(MEM_TABLES, (rowHashMask + 1) * sizeof(*rowHash));
+   }
    gcount = (uint32_t *)calloc(1LL << width, sizeof(*gcount));
-   memusage += (sizeof(*gInd3)+2*sizeof(int)) << (width*2);
+   trackMemory(MEM_TABLES, tableSegMax * sizeof(*tableSegs));
+   trackMemory(MEM_TABLES, (sizeof(*flip)+sizeof(*causesBirth)+sizeof(*gcount)+sizeof(*valorder)) << width);
+   trackMemory(MEM_TABLES, (3LL*params[P_NUMTHREADS]*sizeof(int)) << width);
+   
+   t = wallClock();
+   setupTimes[0] = t - start;
    
+   #pragma omp parallel for schedule(static)
    for (uint32_t j = 0; j < 1LLU << width; ++j)
       causesBirth[j] = (evolveRow(j,0,0) ? 1 : 0);
    for (uint32_t j = 0; j < 1LLU << width; ++j)
       gcount[j] = 0;
    gWorkConcat = (int *)calloc((3LL*params[P_NUMTHREADS])<<width, sizeof(int));
-   if (params[P_REORDER] == 1)
+   if (params[P_REORDER] == ORDER_STATS || params[P_REORDER] == ORDER_ADAPTIVE)
       genStatCounts();
-   if (params[P_REORDER] == 2)   /* this option currently cannot be set at runtime */
+   if (params[P_REORDER] == ORDER_POPCOUNT)
       for (int i=1; i<1<<width; i++)
          gcount[i] = 1 + gcount[i & (i - 1)];
    gcount[0] = 0xffffffff;    /* Maximum value so empty row is chosen first */
+   setupTimes[1] = wallClock() - t;
+   t = wallClock();
+   
    valorder = (uint16_t *)calloc(1LL << width, sizeof(uint16_t));
    for (int i=0; i<1<<width; i++)
       valorder[i] = (uint16_t) ((1<<width)-1-i);
-   if (params[P_REORDER] != 0)
+   if (params[P_REORDER] != ORDER_NATURAL)
       sortRows(valorder, 1<<width);
+   if (params[P_REORDER] == ORDER_ADAPTIVE){
+      if (loadedOrder)
+         memcpy(valorder, loadedOrder, sizeof(*valorder) << width);
+      else
+         allocRowCredit();
+   }
+   free(loadedOrder);
+   loadedOrder = 0;
+   setupTimes[2] = wallClock() - t;
+   t = wallClock();
+   
+   /* the parts for row1 = 0 are needed first; threads build them at once */
+   #pragma omp parallel for schedule(dynamic, 16)
    for (int row2=0; row2<1<<width; row2++)
       makeRow(0, row2);
+   setupTimes[3] = wallClock() - t;
+   setupTimes[4] = wallClock() - start;
 }
 
-uint16_t *bbuf;
-long long int bbuf_left = 0;
+void printSetupTimes(void) {
+   int i;
+   printf("Setup time:");
+   for (i = 0; i < NUM_SETUPSTAGES; ++i)
+      printf("%s %s %.2fs", i ? "," : "", setupStageName[i], setupTimes[i]);
+   printf("\n");
+}
 
-/* reduce fragmentation by allocating chunks larger */
-/* than needed and parceling out the small pieces.  */
-uint16_t *bmalloc(int siz) {
+uint32_t bbuf;            /* offset of the next free entry */
+long long int bbuf_left = 0;
+long long tableSegBytes = 0;
+int evictPending = 0;      /* set when the table grows past the memory limit */
+long long tableEvictions = 0, tableEvicted = 0;
+
+/* reduce fragmentation by allocating segments larger */
+/* than needed and parceling out the small pieces.    */
+/* The piece starts at an odd offset if odd is set.   */
+uint32_t bmalloc(int siz, int odd) {
    if (siz + (1<<width) > bbuf_left) {
-      bbuf_left = (1LL << (2 * width)) + (1LL<<width);
-      memusage += 2*bbuf_left;
-      if (params[P_MEMLIMIT] >= 0 && memusage > memlimit) {
-         printf("Aborting due to excessive memory usage\n");
+      if (numTableSegs == tableSegMax){
+         fprintf(stderr, "Error: lookup table is too large for 32-bit offsets.\n");
+         exit(1);
+      }
+      bbuf_left = 1LL << tableSegBits;
+      trackMemory(MEM_TABLES, 2*bbuf_left);
+      tableSegBytes += 2*bbuf_left;
+      if (overMemoryLimit()) {
+         /* the search goes on until the table can be evicted safely, */
+         /* and deepening stops early so that it is not long         */
+         if (tableEvictable){
+            evictPending = 1;
+            if (deepenStop) atomic_store_explicit(deepenStop, 1, memory_order_relaxed);
+         }
+         else {
+            printMemory();
+            printf("Aborting due to excessive memory usage\n");
+            exit(1);
+         }
+      }
+      tableSegs[numTableSegs] = (uint16_t *)calloc((size_t) bbuf_left, sizeof(uint16_t));
+      if (tableSegs[numTableSegs] == 0){
+         fprintf(stderr, "Error: unable to allocate memory for lookup table.\n");
          exit(1);
       }
-      bbuf = (uint16_t *)calloc((size_t) bbuf_left, sizeof(uint16_t));
+      bbuf = numTableSegs++ << tableSegBits;
+      if (bbuf == 0){      /* offset 0 means "not built" */
+         ++bbuf;
+         --bbuf_left;
+      }
+   }
+   if ((int)(bbuf & 1) != odd){
+      ++bbuf;
+      --bbuf_left;
    }
-   uint16_t *r = bbuf;
+   uint32_t r = bbuf;
    bbuf += siz;
    bbuf_left -= siz;
    return r;
@@ -608,8 +1300,105 @@ unsigned int hashRow(uint16_t *theRow, int siz) {
    return h;
 }
 
-uint16_t *makeRow(int row1, int row2) {
+/* Double the size of rowHash when it is half full */
+void growRowHash(void) {
+   uint32_t *old = rowHash;
+   uint32_t oldMask = rowHashMask;
+   uint32_t i, h;
+   
+   rowHashMask = 2 * rowHashMask + 1;
+   rowHash = (uint32_t *)calloc(rowHashMask + 1, sizeof(*rowHash));
+   if (rowHash == 0){
+      fprintf(stderr, "Error: unable to allocate memory for lookup table.\n");
+      exit(1);
+   }
+   for (i = 0; i <= oldMask; ++i){
+      if (old[i] == 0) continue;
+      uint16_t *theRow = TABLEROW(old[i]);
+      h = hashRow(theRow, tableRowSize(theRow)) & rowHashMask;
+      while (rowHash[h]) h = (h + 1) & rowHashMask;
+      rowHash[h] = old[i];
+   }
+   free(old);
+   trackMemory(MEM_TABLES, (long long)(oldMask + 1) * sizeof(*rowHash));
+}
+
+/* Store the part of the lookup table of siz entries at offset off, just */
+/* given by bmalloc(), as the part for row12, unless an identical part   */
+/* already exists, in which case off is given back and the existing     */
+/* part is used.  Must be called in the critical region updateTable.     */
+uint32_t shareRow(int row12, uint32_t off, int siz) {
+   uint16_t *theRow = TABLEROW(off);
+   unsigned int h = hashRow(theRow, siz) & rowHashMask;
+   while (1) {
+      if (rowHash[h] == 0) {
+         rowHash[h] = off;
+         if (++rowHashCount > rowHashMask / 2) growRowHash();
+         break;
+      }
+      /* Maybe two different row12s result in the exact same rows for the */
+      /* lookup table. This prevents two different threads from trying to */
+      /* build the same part of the lookup table.                         */
+      uint16_t *other = TABLEROW(rowHash[h]);
+      if (tableRowSize(other) == siz && memcmp(theRow, other, 2*siz) == 0) {
+         off = rowHash[h];
+         unbmalloc(siz);
+         break;
+      }
+      h = (h + 1) & rowHashMask;
+   }
+   
+   atomic_store_explicit(&gInd3[row12], off, memory_order_release);
+   return off;
+}
+
+/* Write a part of the lookup table in the form chosen by makeRow() */
+static void writeRow(uint16_t *theRow, int sparse, int m, int good,
+                     int *gWork, int *gWork2, int *gWork3) {
+   if (sparse) {
+      uint16_t *bitmap = theRow + 2 + 2*m;
+      int j = 0, start = 2 + 2*m + SPARSEBITMAP;
+      theRow[0] = (uint16_t) m;
+      for (int i=0; i < SPARSEBITMAP; i++)
+         bitmap[i] = 0;
+      for (int row4=0; row4 < 1<<width; row4++) {
+         if (gWork3[row4] == 0) continue;
+         bitmap[row4 >> 4] |= (uint16_t)(1 << (row4 & 15));
+         theRow[1 + j] = (uint16_t) row4;
+         theRow[1 + m + j] = (uint16_t) start;
+         start += gWork3[row4];
+         gWork3[row4] = theRow[1 + m + j];    /* next free place in the list */
+         ++j;
+      }
+      theRow[1 + 2*m] = (uint16_t) start;
+      for (int row3=0; row3 < good; row3++)
+         theRow[gWork3[gWork[row3]]++] = (uint16_t)gWork2[row3];
+      return;
+   }
+   for (int row3=0; row3 < 1<<width; row3++)
+      theRow[row3] = 0;
+   theRow[0] = 1 + (1 << width);
+   for (int row3=0; row3 < good; row3++)
+      theRow[gWork[row3]]++;
+   theRow[1<<width] = 0;
+   for (int row3=0; row3 < (1<<width); row3++)
+      theRow[row3+1] += theRow[row3];
+   for (int row3=good-1; row3>=0; row3--) {
+      int row4 = gWork[row3];
+      theRow[--theRow[row4]] = (uint16_t)gWork2[row3];
+   }
+}
+
+uint32_t makeRow(int row1, int row2) {
    int good = 0;
+   
+   /* a cold part is still there; it only has to be marked as used */
+   if (tableEvictable) {
+      uint32_t r = atomic_fetch_and_explicit(&gInd3[(row1 << width) + row2],
+                                             ~TABLECOLD, memory_order_acq_rel);
+      if (r) return r & ~TABLECOLD;
+   }
+   
    /* Set up gWork for this particular thread */
    int *gWork = gWorkConcat + ((3LL * omp_get_thread_num()) << width);
    int *gWork2 = gWork + (1 << width);
@@ -649,49 +1438,33 @@ uint16_t *makeRow(int row1, int row2) {
       gWork[good++] = row4;
    }
    
+   /* count the row4s with a nonempty list to choose the form */
+   int m = 0;
+   for (int row4=0; row4 < 1<<width; row4++)
+      gWork3[row4] = 0;
+   for (int row3=0; row3 < good; row3++)
+      if (gWork3[gWork[row3]]++ == 0) ++m;
+   int sparseSize = 2 + 2*m + SPARSEBITMAP + good;
+   int sparse = sparseTable && 2*sparseSize <= 1+(1<<width)+good;
+   int siz = sparse ? sparseSize : 1+(1<<width)+good;
+   
+   if (sharedTable) {
+      uint16_t *theRow = gRowScratch + (size_t)omp_get_thread_num() * ((2 << width) + 2);
+      writeRow(theRow, sparse, m, good, gWork, gWork2, gWork3);
+      return publishSharedRow((row1 << width) + row2, theRow, siz, sparse);
+   }
+   
    /* bmalloc, unbmalloc, and all operations that read from or write to */
    /* theRow, rowHash, and gInd3 must be included in a critical region. */
-   uint16_t *theRow;
+   uint32_t off;
    #pragma omp critical(updateTable)
    {
-      theRow = bmalloc((1+(1<<width)+good));
-      for (int row3=0; row3 < 1<<width; row3++)
-         theRow[row3] = 0;
-      theRow[0] = 1 + (1 << width);
-      for (int row3=0; row3 < good; row3++)
-         theRow[gWork[row3]]++;
-      theRow[1<<width] = 0;
-      for (int row3=0; row3 < (1<<width); row3++)
-         theRow[row3+1] += theRow[row3];
-      for (int row3=good-1; row3>=0; row3--) {
-         int row4 = gWork[row3];
-         theRow[--theRow[row4]] = (uint16_t)gWork2[row3];
-      }
-      unsigned int h = hashRow(theRow, 1+(1<<width)+good);
-      h &= (2 << (2 * width)) - 1;
-      while (1) {
-         if (rowHash[h] == -1) {
-            rowHash[h] = (row1 << width) + row2;
-            break;
-         }
-         /* Maybe two different row12s result in the exact same rows for the */
-         /* lookup table. This prevents two different threads from trying to */
-         /* build the same part of the lookup table.                         */
-         if (memcmp( theRow,
-                     atomic_load_explicit(&gInd3[rowHash[h]], memory_order_relaxed),
-                     2*(1+(1<<width)+good)
-                   ) == 0) {
-            theRow = gInd3[rowHash[h]];
-            unbmalloc(1+(1<<width)+good);
-            break;
-         }
-         h = (h + 1) & ((2 << (2 * width)) - 1);
-      }
-      
-      atomic_store_explicit(&gInd3[(row1<<width)+row2], theRow, memory_order_relaxed);
+      off = bmalloc(siz, sparse);
+      writeRow(TABLEROW(off), sparse, m, good, gWork, gWork2, gWork3);
+      off = shareRow((row1 << width) + row2, off, siz);
    }
    
-   return theRow;
+   return off;
 }
 
 /*   We calculate the stats using a 2 * 64 << width array.  We use a
@@ -717,30 +1490,34 @@ void genStatCounts(void) {
          for (int row3=0; row3<2; row3++)
             if (evolveBit(row1, row2, row3) == 0)
                cnt[(1<<6) + (row1 << 4) + (row2 << 2) + row3]++;
+   /* each row4 only adds into the counts for its own two extensions, */
+   /* so the row4s of one step can be handled by different threads    */
    for (int nb=0; nb<width; nb++) {
-      for (int row1=0; row1<8; row1++)
-         for (int row2=0; row2<8; row2++)
-            for (int row3=0; row3<8; row3++) {
-               if (nb == width-1)
-                  if ((((row1 >> s) ^ row1) & 1) ||
-                      (((row2 >> s) ^ row2) & 1) ||
-                      (((row3 >> s) ^ row3) & 1))
-                     continue;
-               int row4b = evolveBit(row1, row2, row3);
-               for (int row4=0; row4<1<<nb; row4++)
+      #pragma omp parallel for schedule(static) if (nb >= 8)
+      for (int row4=0; row4<1<<nb; row4++)
+         for (int row1=0; row1<8; row1++)
+            for (int row2=0; row2<8; row2++)
+               for (int row3=0; row3<8; row3++) {
+                  if (nb == width-1)
+                     if ((((row1 >> s) ^ row1) & 1) ||
+                         (((row2 >> s) ^ row2) & 1) ||
+                         (((row3 >> s) ^ row3) & 1))
+                        continue;
+                  int row4b = evolveBit(row1, row2, row3);
                   cnt[(((((1<<nb) + row4) << 1) + row4b) << 6) +
                     ((row1 & 3) << 4) + ((row2 & 3) << 2) + (row3 & 3)] +=
                      cnt[(((1<<nb) + row4) << 6) +
                        ((row1 >> 1) << 4) + ((row2 >> 1) << 2) + (row3 >> 1)];
-            }
+               }
    }
    /* right side; check left, and accumulate into gcount */
-   for (int row1=0; row1<4; row1++)
-      for (int row2=0; row2<4; row2++)
-         for (int row3=0; row3<4; row3++)
-            if (params[P_SYMMETRY] != SYM_ASYM ||
-                evolveBit(row1<<1, row2<<1, row3<<1) == 0)
-               for (int row4=0; row4<1<<width; row4++)
+   #pragma omp parallel for schedule(static)
+   for (int row4=0; row4<1<<width; row4++)
+      for (int row1=0; row1<4; row1++)
+         for (int row2=0; row2<4; row2++)
+            for (int row3=0; row3<4; row3++)
+               if (params[P_SYMMETRY] != SYM_ASYM ||
+                   evolveBit(row1<<1, row2<<1, row3<<1) == 0)
                   gcount[row4] +=
                      cnt[(((1<<width) + row4) << 6) +
                        (row1 << 4) + (row2 << 2) + row3];
@@ -817,6 +1594,32 @@ static inline void setVisited(node b) {
    if (hash != 0) hash[ hashFunction(PARENT(b),ROW(b)) ] = b;
 }
 
+/* isVisited() for a state held as rows, ending at pRows[r] and needing */
+/* pRows[r - 2*period] for the hash, as in the depth-first searches.     */
+static inline int rowsVisited(row *pRows, uint32_t r) {
+   long h = pRows[r];
+   int i;
+   node p;
+   if (hash == 0) return 0;
+   if (params[P_SYMMETRY] == SYM_ASYM) h += flip[pRows[r]];
+   for (i = 1; i <= nRowsInState; i++) {
+      h = (h * 269) + pRows[r - i];
+      if (params[P_SYMMETRY] == SYM_ASYM) h += flip[pRows[r - i]];
+   }
+   h += (h>>16)*269;
+   h += (h>>8)*269;
+   p = hash[h & HASHMASK];
+   if (p == 0) return 0;
+   for (i = 0; i < nRowsInState && !EMPTY(p) && ROW(p) == pRows[r - i]; i++)
+      p = PARENT(p);
+   if (i == nRowsInState) return 1;
+   if (params[P_SYMMETRY] != SYM_ASYM) return 0;
+   p = hash[h & HASHMASK];
+   for (i = 0; i < nRowsInState && !EMPTY(p) && flip[ROW(p)] == pRows[r - i]; i++)
+      p = PARENT(p);
+   return i == nRowsInState;
+}
+
 /* ============================================== */
 /*  Output patterns found by successful searches  */
 /* ============================================== */
@@ -868,46 +1671,307 @@ safeShift(unsigned long r, int i) {
     return (rr>>i);
 }
 
-int sxsAllocRows =  0;
-unsigned long * sxsAllocData;
-unsigned long * sxsAllocData2;
-int oldnrows = 0;
-unsigned long * oldsrows;
-unsigned long * oldssrows;
-
-/* Buffers RLE into patternBuf; returns 1 if pattern successfully buffered */ 
-int bufferPattern(node b, row *pRows, int nodeRow, uint32_t lastRow, int printExpected) {
-   node c;
-   int nrows = 0;
-   int swidth;
-   int sxsNeeded;
-   int p, i, j, margin;
-   unsigned long *srows, *ssrows;
+/* ================= */
+/*  Known spaceships */
+/* ================= */
 
-   uint32_t currRow = lastRow;
-   int nDeepRows = 0;
-   int nodeDiff;
+/* Spaceships read from the --known file are kept as their rows (bit 0 is the
+   leftmost column), trimmed so that the first row and column are live, in a
+   hash table together with their mirror images.  Spaceships found by the
+   search are converted the same way from their RLE before they are printed. */
 
-   if (pRows != NULL){
-      while (pRows[currRow] == 0){
-         if (currRow == 0){
-            if (!printExpected) return 0;
-            printf("Success called on search root!\n");
-            aborting = 1;
-            return 0;
-         }
-         currRow--;
+typedef struct {
+   int nrows;
+   uint64_t *rows;
+} knownShip;
+
+char *knownFile;
+knownShip *knownShips;
+int numKnown = 0;                /* counting mirror images */
+int knownLoaded = 0;             /* patterns read from knownFile */
+uint32_t *knownTable;            /* index+1 into knownShips, 0 for a free slot */
+uint32_t knownMask;
+int knownMatch;                  /* set when bufferPattern() skips a known ship */
+long long knownSkipped = 0;
+
+/* Decode the next RLE pattern in *text into *rows.  A pattern starts at a
+   header line "x = ..." and ends at '!'; other lines before the header, such
+   as comments or the rest of a qfind output file, are skipped.  Returns the
+   number of rows (0 if the pattern is empty), -1 if it is wider than 64
+   cells, -2 if there is no further pattern, or -3 if the pattern has no '!' */
+static int decodeRLE(const char **text, uint64_t **rows, int *rowsCap) {
+   const char *p = *text;
+   int y = 0, x = 0, count = 0, nrows = 0, tooWide = 0;
+
+   /* find the header and skip past it */
+   for (;;){
+      const char *q = p;
+      while (*q == ' ' || *q == '\t') ++q;
+      if (*q == 'x'){
+         for (++q; *q == ' ' || *q == '\t'; ++q) { }
+         if (*q == '=') break;
       }
-      nDeepRows = (currRow / period) - 1;
-      nodeDiff = nodeRow - period - (currRow%period);
-      nodeRow -= nodeDiff;
-
-      for (j = 0; j < nodeDiff; j++){
-         b = PARENT(b);
+      while (*p && *p != '\n') ++p;
+      if (!*p){
+         *text = p;
+         return -2;
       }
-      currRow = currRow - period + 1;
-      nrows = nDeepRows;
-      
+      ++p;
+   }
+   while (*p && *p != '\n') ++p;
+
+   for (; *p; ++p){
+      char ch = *p;
+      int k;
+      if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') continue;
+      if (ch >= '0' && ch <= '9'){
+         count = 10 * count + (ch - '0');
+         continue;
+      }
+      k = count ? count : 1;
+      count = 0;
+      if (ch == '!'){
+         *text = p + 1;
+         return tooWide ? -1 : nrows;
+      }
+      if (ch == '$'){
+         y += k;
+         x = 0;
+      }
+      else if (ch == 'b' || ch == '.') x += k;
+      else if (ch == 'x' || ch == '#'){
+         break;      /* the next header or a comment: this pattern has no end */
+      }
+      else{
+         if (x + k > 64) tooWide = 1;
+         else{
+            while (nrows <= y){
+               if (nrows == *rowsCap){
+                  *rowsCap = *rowsCap ? 2 * *rowsCap : 64;
+                  *rows = (uint64_t*)realloc(*rows, *rowsCap * sizeof(uint64_t));
+                  if (*rows == 0){
+                     fprintf(stderr, "Error: unable to allocate memory for known spaceships.\n");
+                     exit(1);
+                  }
+               }
+               (*rows)[nrows++] = 0;
+            }
+            while (k--) (*rows)[y] |= (uint64_t)1 << x++;
+         }
+      }
+   }
+   *text = p;
+   return -3;
+}
+
+/* Trim empty rows and columns so that the first row and column are live;
+   returns the new number of rows */
+static int trimRows(uint64_t *rows, int nrows) {
+   int first = 0, i;
+   uint64_t all = 0;
+
+   while (nrows > 0 && rows[nrows - 1] == 0) --nrows;
+   while (first < nrows && rows[first] == 0) ++first;
+   nrows -= first;
+   if (nrows <= 0) return 0;
+   memmove(rows, rows + first, nrows * sizeof(uint64_t));
+   for (i = 0; i < nrows; ++i) all |= rows[i];
+   while (!(all & 1)){
+      all >>= 1;
+      for (i = 0; i < nrows; ++i) rows[i] >>= 1;
+   }
+   return nrows;
+}
+
+static uint32_t knownHash(const uint64_t *rows, int nrows) {
+   uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)nrows;
+   int i;
+   for (i = 0; i < nrows; ++i){
+      h ^= rows[i];
+      h *= 0x100000001b3ULL;
+      h ^= h >> 29;
+   }
+   return (uint32_t)(h ^ (h >> 32));
+}
+
+/* Return the index+1 of the known ship with these rows, or 0 */
+static uint32_t findKnown(const uint64_t *rows, int nrows) {
+   uint32_t i = knownHash(rows, nrows) & knownMask;
+
+   while (knownTable[i]){
+      knownShip *s = &knownShips[knownTable[i] - 1];
+      if (s->nrows == nrows && !memcmp(s->rows, rows, nrows * sizeof(uint64_t)))
+         return knownTable[i];
+      i = (i + 1) & knownMask;
+   }
+   return 0;
+}
+
+static void addKnown(const uint64_t *rows, int nrows) {
+   static int capKnown = 0;
+   uint32_t i;
+
+   if (findKnown(rows, nrows)) return;
+
+   /* grow the list, and the hash table to keep it at most half full */
+   if (numKnown == capKnown){
+      capKnown = capKnown ? 2 * capKnown : 64;
+      knownShips = (knownShip*)realloc(knownShips, capKnown * sizeof(knownShip));
+      if (knownShips == 0){
+         fprintf(stderr, "Error: unable to allocate memory for known spaceships.\n");
+         exit(1);
+      }
+   }
+   if (2 * (numKnown + 1) > (int)knownMask + 1){
+      uint32_t *old = knownTable, oldMask = knownMask;
+      knownMask = 2 * knownMask + 1;
+      knownTable = (uint32_t*)calloc(knownMask + 1, sizeof(uint32_t));
+      if (knownTable == 0){
+         fprintf(stderr, "Error: unable to allocate memory for known spaceships.\n");
+         exit(1);
+      }
+      for (i = 0; i <= oldMask; ++i){
+         uint32_t j;
+         knownShip *k;
+         if (!old[i]) continue;
+         k = &knownShips[old[i] - 1];
+         for (j = knownHash(k->rows, k->nrows) & knownMask; knownTable[j]; j = (j + 1) & knownMask) { }
+         knownTable[j] = old[i];
+      }
+      free(old);
+   }
+   knownShips[numKnown].nrows = nrows;
+   knownShips[numKnown].rows = (uint64_t*)malloc(nrows * sizeof(uint64_t));
+   if (knownShips[numKnown].rows == 0){
+      fprintf(stderr, "Error: unable to allocate memory for known spaceships.\n");
+      exit(1);
+   }
+   memcpy(knownShips[numKnown].rows, rows, nrows * sizeof(uint64_t));
+   ++numKnown;
+   for (i = knownHash(rows, nrows) & knownMask; knownTable[i]; i = (i + 1) & knownMask) { }
+   knownTable[i] = numKnown;
+}
+
+void loadKnown(const char *file) {
+   FILE *fp;
+   char *text;
+   const char *p;
+   long size;
+   int nrows, cap = 0, i, j, w;
+   uint64_t *rows = 0, *mirror = 0, all;
+
+   fp = fopen(file, "rb");
+   if (!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)){
+      fprintf(stderr, "Error: unable to read known spaceship file %s.\n", file);
+      exit(1);
+   }
+   text = (char*)malloc(size + 1);
+   if (text == 0 || fread(text, 1, size, fp) != (size_t)size){
+      fprintf(stderr, "Error: unable to read known spaceship file %s.\n", file);
+      exit(1);
+   }
+   fclose(fp);
+   text[size] = '\0';
+
+   knownMask = 127;
+   knownTable = (uint32_t*)calloc(knownMask + 1, sizeof(uint32_t));
+   if (knownTable == 0){
+      fprintf(stderr, "Error: unable to allocate memory for known spaceships.\n");
+      exit(1);
+   }
+
+   p = text;
+   while ((nrows = decodeRLE(&p, &rows, &cap)) != -2){
+      if (nrows == -1){
+         fprintf(stderr, "Warning: ignoring known pattern wider than 64 cells in %s.\n", file);
+         continue;
+      }
+      if (nrows == -3){
+         fprintf(stderr, "Warning: ignoring known pattern without a final '!' in %s.\n", file);
+         continue;
+      }
+      nrows = trimRows(rows, nrows);
+      if (nrows == 0) continue;
+      ++knownLoaded;
+      addKnown(rows, nrows);
+
+      /* add the mirror image */
+      mirror = (uint64_t*)realloc(mirror, cap * sizeof(uint64_t));
+      for (all = 0, i = 0; i < nrows; ++i) all |= rows[i];
+      for (w = 0; w < 64 && (all >> w); ++w) { }
+      for (i = 0; i < nrows; ++i){
+         mirror[i] = 0;
+         for (j = 0; j < w; ++j)
+            if (rows[i] >> j & 1) mirror[i] |= (uint64_t)1 << (w - 1 - j);
+      }
+      addKnown(mirror, nrows);
+   }
+   free(text);
+   free(rows);
+   free(mirror);
+
+   if (numKnown == 0) fprintf(stderr, "Warning: no known spaceships found in %s.\n", file);
+}
+
+/* Test whether the RLE in buf is one of the known spaceships */
+static int isKnown(const char *buf) {
+   static uint64_t *rows = 0;
+   static int cap = 0;
+   int nrows = decodeRLE(&buf, &rows, &cap);
+
+   if (nrows <= 0) return 0;
+   nrows = trimRows(rows, nrows);
+   return nrows > 0 && findKnown(rows, nrows) != 0;
+}
+
+int sxsAllocRows =  0;
+unsigned long * sxsAllocData;
+unsigned long * sxsAllocData2;
+
+/* The last pattern each thread printed, so that a thread which finds the  */
+/* same spaceship again does not print it twice even if other threads have */
+/* printed something in between.                                           */
+typedef struct {
+   int nrows;
+   int known;                    /* the saved rows are a known spaceship */
+   unsigned long *srows, *ssrows;
+} printedPattern;
+
+printedPattern *lastPrinted;
+
+/* Buffers RLE into patternBuf; returns 1 if pattern successfully buffered */ 
+int bufferPattern(node b, row *pRows, int nodeRow, uint32_t lastRow, int printExpected) {
+   node c;
+   int nrows = 0;
+   int swidth;
+   int sxsNeeded;
+   int p, i, j, margin;
+   unsigned long *srows, *ssrows;
+
+   uint32_t currRow = lastRow;
+   int nDeepRows = 0;
+   int nodeDiff;
+
+   if (pRows != NULL){
+      while (pRows[currRow] == 0){
+         if (currRow == 0){
+            if (!printExpected) return 0;
+            printf("Success called on search root!\n");
+            aborting = 1;
+            return 0;
+         }
+         currRow--;
+      }
+      nDeepRows = (currRow / period) - 1;
+      nodeDiff = nodeRow - period - (currRow%period);
+      nodeRow -= nodeDiff;
+
+      for (j = 0; j < nodeDiff; j++){
+         b = PARENT(b);
+      }
+      currRow = currRow - period + 1;
+      nrows = nDeepRows;
+      
    }
    else{
       /* shift until we find nonzero row.
@@ -947,8 +2011,7 @@ int bufferPattern(node b, row *pRows, int nodeRow, uint32_t lastRow, int printEx
       sxsAllocRows = sxsNeeded;
       sxsAllocData = (unsigned long*)malloc(sxsAllocRows * sizeof(unsigned long));
       sxsAllocData2 = (unsigned long*)malloc(sxsAllocRows * sizeof(unsigned long));
-      oldsrows = (unsigned long*)calloc(sxsAllocRows, sizeof(unsigned long));
-      oldssrows = (unsigned long*)calloc(sxsAllocRows, sizeof(unsigned long));
+      lastPrinted = (printedPattern*)calloc(MAX(params[P_NUMTHREADS], 1), sizeof(*lastPrinted));
       patternBuf = (char*)malloc(((2 * MAXWIDTH + 4) * sxsAllocRows + 300) * sizeof(char));
    }
    else if (sxsAllocRows < sxsNeeded)
@@ -1060,20 +2123,25 @@ int bufferPattern(node b, row *pRows, int nodeRow, uint32_t lastRow, int printEx
    margin = 0;
 
    /* make sure we didn't just output the exact same pattern */
+   printedPattern *last = &lastPrinted[omp_get_thread_num()];
    if (printExpected){
-      if (nrows == oldnrows) {
+      if (nrows == last->nrows) {
          int different = 0;
          for (i = 0; i < nrows && !different; i++)
-            different = (srows[i] != oldsrows[i] || ssrows[i] != oldssrows[i]);
-         if (!different) return 0;
+            different = (srows[i] != last->srows[i] || ssrows[i] != last->ssrows[i]);
+         if (!different){
+            knownMatch = last->known;
+            return 0;
+         }
       }
       
       /* replace previous saved rows with new rows */
-      oldnrows = nrows;
-      oldsrows = (unsigned long*)realloc(oldsrows, sxsAllocRows * sizeof(unsigned long));
-      oldssrows = (unsigned long*)realloc(oldssrows, sxsAllocRows * sizeof(unsigned long));
-      memcpy(oldsrows, srows, nrows * sizeof(unsigned long));
-      memcpy(oldssrows, ssrows, nrows * sizeof(unsigned long));
+      last->nrows = nrows;
+      last->known = 0;
+      last->srows = (unsigned long*)realloc(last->srows, sxsAllocRows * sizeof(unsigned long));
+      last->ssrows = (unsigned long*)realloc(last->ssrows, sxsAllocRows * sizeof(unsigned long));
+      memcpy(last->srows, srows, nrows * sizeof(unsigned long));
+      memcpy(last->ssrows, ssrows, nrows * sizeof(unsigned long));
    }
    
    /* Buffer output */
@@ -1090,6 +2158,13 @@ int bufferPattern(node b, row *pRows, int nodeRow, uint32_t lastRow, int printEx
    bufRLE('\0');
    sprintf(patternBuf+strlen(patternBuf),"\n");
    
+   /* don't print or count spaceships listed with --known */
+   if (printExpected && numKnown && isKnown(patternBuf)){
+      ++knownSkipped;
+      knownMatch = last->known = 1;
+      return 0;
+   }
+   
    if (printExpected){
       numFound++;
       if (params[P_NUMSHIPS] > 0){
@@ -1105,13 +2180,16 @@ void makeSubperiodTables(void);
 int subperiodic(node x, row *pRows, int nodeRow, uint32_t lastRow);
 #endif
 
-void success(node b, row *pRows, int nodeRow, uint32_t lastRow) {
+/* Print a spaceship; returns 1 if it was skipped as a known spaceship */
+int success(node b, row *pRows, int nodeRow, uint32_t lastRow) {
 #ifndef QSIMPLE
-   if (subperiodic(b, pRows, nodeRow, lastRow)) return;
+   if (subperiodic(b, pRows, nodeRow, lastRow)) return 0;
 #endif
+   knownMatch = 0;
    if (bufferPattern(b, pRows, nodeRow, lastRow, 1))
       printf("\n%s\n",patternBuf);
    fflush(stdout);
+   return knownMatch;
 }
 
 /* Test if this is a node at which we can stop */
@@ -1140,42 +2218,78 @@ node qHead,qTail;
 node qStart; /* index of first node in queue */
 node qEnd;   /* index of first unused node after end of queue */
 
-/* Maintain phase of queue nodes.  After dequeue(), the global variable phase
-** gives the phase of the dequeued item.  If the queue is compacted, this information
-** needs to be reinitialized by a call to rephase(), after which phase will not be
-** valid until the next call to dequeue().  Variable nextRephase points to the next
-** node for which dequeue will need to increment the phase. Phase is not maintained
-** when treating queue as a stack (using pop()) -- caller must do it in that case.
-** It's ok to change phase since we maintain a separate copy in queuePhase.
+/* Maintain the generations of the queue.  genStart[d] is the index of the first
+** node of depth d (the root has depth 1) and genTop is the depth of the last node
+** in the queue.  enqueue() starts a new generation whenever the parent is in the
+** last one, and dequeue() keeps headGen equal to the depth of the node at qHead,
+** so the depth and phase of any queue node can be found without walking back to
+** the root.  After dequeue(), the global variable phase gives the phase of the
+** dequeued item.  If the queue is compacted or loaded, the table needs to be
+** rebuilt by a call to rephase(), after which phase will not be valid until the
+** next call to dequeue().  Phase is not maintained when treating queue as a stack
+** (using pop()) -- caller must do it in that case.
 */
-int queuePhase = 0;
-node nextRephase = 0;
-
-void rephase(void) {
-   node x, y;
-   while (qHead < qTail && EMPTY(qHead)) qHead++;   /* skip empty queue cells */
-   x = qHead;   /* find next item in queue */
-   queuePhase = period - 1;
-   while (x != 0) {
-      x = PARENT(x);
-      queuePhase++;
+node *genStart = 0;
+int genTop = 0;      /* depth of the last node in the queue */
+int genCap = 0;      /* allocated length of genStart */
+int headGen = 0;     /* depth of the node at qHead */
+
+#define DEPTHPHASE(d) (((d) + period - 2) % period)
+
+static void newGeneration(node i) {
+   if (++genTop >= genCap){
+      trackMemory(MEM_OTHER, (genCap ? genCap : 1024) * sizeof(*genStart));
+      genCap = genCap ? 2 * genCap : 1024;
+      genStart = (node*)realloc(genStart, genCap * sizeof(*genStart));
+      if (genStart == 0){
+         fprintf(stderr, "Error: unable to allocate memory for generation table.\n");
+         exit(1);
+      }
    }
-   queuePhase %= period;
+   genStart[genTop] = i;
+}
 
-   /* Now walk forward through queue finding breakpoints between each generation. */
-   /* invariants: y is always the first in its generation                         */
-   x = 0; y = 0;
-   while (y <= qHead) {
-      ++x;
-      if (x >= qTail || (!EMPTY(x) && PARENT(x) >= y)) y = x;
+/* depth of queue node i */
+static inline int nodeDepth(node i) {
+   int lo, hi;
+   
+   /* nodes waiting in the queue are in the generation at qHead or the next one */
+   if (headGen > 0 && i >= genStart[headGen]){
+      if (headGen == genTop || i < genStart[headGen + 1]) return headGen;
+      if (headGen + 1 == genTop || i < genStart[headGen + 2]) return headGen + 1;
+   }
+   lo = 1; hi = genTop;
+   while (lo < hi){
+      int mid = (lo + hi + 1) / 2;
+      if (genStart[mid] <= i) lo = mid;
+      else hi = mid - 1;
    }
-   nextRephase = y;
+   return lo;
+}
+
+void rephase(void) {
+   node x;
+   while (qHead < qTail && EMPTY(qHead)) qHead++;   /* skip empty queue cells */
+   
+   /* Walk forward through queue finding breakpoints between each generation. */
+   genTop = 0;
+   headGen = 0;
+   if (qTail == 0) return;
+   newGeneration(0);
+   for (x = 1; x < qTail; ++x)
+      if (!EMPTY(x) && PARENT(x) >= genStart[genTop]) newGeneration(x);
+   headGen = nodeDepth(qHead);
 }
 
 /* peekPhase() returns the phase of an element in the queue.  This only */
 /* works for queue elements and should NOT be used on other nodes.      */
 int peekPhase(node i) {
-   return (i < nextRephase? queuePhase : (queuePhase+1)%period);
+   return DEPTHPHASE(nodeDepth(i));
+}
+
+/* first node of the generation after the one at qHead */
+static inline node nextGeneration(void) {
+   return headGen < genTop ? genStart[headGen + 1] : qTail;
 }
 
 /* Test queue status */
@@ -1215,9 +2329,12 @@ static inline void enqueue(node b, row r) {
       } else rows[i] = (row)(o << width) + r;
    }
    
+   if (i == 0) genTop = 0;    /* the root; the queue is being rebuilt */
+   if (i == 0 || b >= genStart[genTop]) newGeneration(i);
+   
    /* update tail of parallel queue, but don't set value */
    deepQTail += qTail - tempQTail;
-   deepRowIndices[deepQTail] = 0;
+   if (deepQTail < QSIZE) deepRowIndices[deepQTail] = 0;
 }
 
 static inline node dequeue(void) {
@@ -1226,11 +2343,9 @@ static inline node dequeue(void) {
       ++qHead;
       ++deepQHead;
    }
-   if (qHead >= nextRephase) {
-      queuePhase = (queuePhase+1)%period;
-      nextRephase = qTail;
-   }
-   phase = queuePhase;
+   while (headGen < genTop && qHead >= genStart[headGen + 1])
+      ++headGen;
+   phase = DEPTHPHASE(headGen);
    ++deepQHead;
    return qHead++;
 }
@@ -1245,8 +2360,290 @@ void resetQ(void) {
    qHead = qTail = 0; deepQHead = deepQTail = 0;
 }
 
+void freeQueue(void) {
+   trackMemory(MEM_QUEUE, -(long long)((QSIZE>>BASEBITS)*sizeof(node) + QSIZE*sizeof(row)));
+   if (hash) trackMemory(MEM_HASH, -(long long)(HASHSIZE*sizeof(node)));
+   free(base);
+   free(rows);
+   free(hash);
+}
+
 //static inline int qTop() { return qTail - 1; }
 
+/* ==================================== */
+/*  Storage for depth-first extensions  */
+/* ==================================== */
+
+/* Extension records are carved out of large arenas instead of being
+** allocated one at a time.  Each thread bump-allocates from its own
+** arena, so saving an extension never takes a lock.  Records are not
+** freed individually; their indices go on a lock-free free list, and
+** compactDeepRows() copies the live records into fresh arenas and
+** releases the old ones after each queue compaction.
+**
+** The free list is a stack of indices linked through deepFreeNext[].
+** The low 32 bits of deepFreeHead hold the top index (0 for an empty
+** stack) and the high 32 bits hold a counter which is incremented on
+** every change to avoid the ABA problem.
+*/
+#define DEEPLIMIT (1LLU << (params[P_DEPTHLIMIT] + 1))
+#define DEEPARENAROWS (1LLU << 20)
+
+typedef struct {
+   row *rows;
+   size_t used, size;
+} deepArena;
+
+deepArena *deepThreadArena = 0;     /* current arena of each thread */
+row **deepArenaList = 0;            /* all arenas in use */
+uint32_t deepArenaCount = 0, deepArenaMax = 0;
+long long deepArenaBytes = 0;
+
+_Atomic uint32_t *deepFreeNext = 0;
+_Atomic uint64_t deepFreeHead = 0;
+_Atomic uint32_t deepNextIndex = 2; /* indices 0 and 1 are reserved */
+
+void allocDeepRows(void) {
+   deepRows = (row**)calloc(DEEPLIMIT, sizeof(*deepRows));
+   deepRowIndices = (uint32_t*)calloc(QSIZE, sizeof(*deepRowIndices));
+   deepFreeNext = (_Atomic uint32_t*)calloc(DEEPLIMIT, sizeof(*deepFreeNext));
+   deepThreadArena = (deepArena*)calloc(params[P_NUMTHREADS] + 1, sizeof(*deepThreadArena));
+   if (!deepRows || !deepRowIndices || !deepFreeNext || !deepThreadArena){
+      fprintf(stderr, "Error: unable to allocate memory for depth-first extensions.\n");
+      exit(1);
+   }
+   trackMemory(MEM_QUEUE, QSIZE*sizeof(*deepRowIndices));
+   trackMemory(MEM_EXTENSIONS, DEEPLIMIT*(sizeof(*deepRows)+sizeof(*deepFreeNext)));
+   atomic_store_explicit(&deepFreeHead, 0, memory_order_relaxed);
+   atomic_store_explicit(&deepNextIndex, 2, memory_order_relaxed);
+}
+
+void releaseDeepArenas(void) {
+   uint32_t i;
+   for (i = 0; i < deepArenaCount; ++i)
+      free(deepArenaList[i]);
+   free(deepArenaList);
+   deepArenaList = 0;
+   deepArenaCount = deepArenaMax = 0;
+   trackMemory(MEM_EXTENSIONS, -deepArenaBytes);
+   deepArenaBytes = 0;
+   memset(deepThreadArena, 0, (params[P_NUMTHREADS] + 1) * sizeof(*deepThreadArena));
+}
+
+void freeDeepRows(void) {
+   releaseDeepArenas();
+   trackMemory(MEM_QUEUE, -(long long)(QSIZE*sizeof(*deepRowIndices)));
+   trackMemory(MEM_EXTENSIONS, -(long long)(DEEPLIMIT*(sizeof(*deepRows)+sizeof(*deepFreeNext))));
+   free(deepRows);
+   free(deepRowIndices);
+   free((void*)deepFreeNext);
+   free(deepThreadArena);
+   deepRows = 0;
+   deepRowIndices = 0;
+   deepFreeNext = 0;
+   deepThreadArena = 0;
+}
+
+/* Give arena a a new block with room for size rows */
+void newDeepArena(deepArena *a, size_t size) {
+   row *r = (row*)malloc(size * sizeof(*r));
+   if (r == 0){
+      fprintf(stderr, "Error: unable to allocate memory for depth-first extensions.\n");
+      exit(1);
+   }
+   #pragma omp critical(deepArenaList)
+   {
+      if (deepArenaCount == deepArenaMax){
+         deepArenaMax = deepArenaMax ? 2 * deepArenaMax : 64;
+         deepArenaList = (row**)realloc(deepArenaList, deepArenaMax * sizeof(*deepArenaList));
+         if (deepArenaList == 0){
+            fprintf(stderr, "Error: unable to allocate memory for depth-first extensions.\n");
+            exit(1);
+         }
+      }
+      deepArenaList[deepArenaCount++] = r;
+      deepArenaBytes += size * sizeof(*r);
+      trackMemory(MEM_EXTENSIONS, size * sizeof(*r));
+   }
+   a->rows = r;
+   a->used = 0;
+   a->size = size;
+}
+
+/* Get space for n rows from the calling thread's arena */
+row *deepAlloc(size_t n) {
+   deepArena *a = &deepThreadArena[omp_get_thread_num()];
+   if (a->used + n > a->size)
+      newDeepArena(a, MAX(DEEPARENAROWS, n));
+   a->used += n;
+   return a->rows + a->used - n;
+}
+
+/* Get an unused extension index, or 0 if there are none left */
+uint32_t newDeepIndex(void) {
+   uint64_t top = atomic_load_explicit(&deepFreeHead, memory_order_acquire);
+   while ((uint32_t) top) {
+      uint32_t i = (uint32_t) top;
+      uint64_t next = (((top >> 32) + 1) << 32)
+                      | atomic_load_explicit(&deepFreeNext[i], memory_order_relaxed);
+      if (atomic_compare_exchange_weak_explicit(&deepFreeHead, &top, next,
+                                                memory_order_acquire, memory_order_acquire))
+         return i;
+   }
+   uint32_t i = atomic_fetch_add_explicit(&deepNextIndex, 1, memory_order_relaxed);
+   if (i >= DEEPLIMIT) {
+      atomic_store_explicit(&deepNextIndex, (uint32_t) DEEPLIMIT, memory_order_relaxed);
+      return 0;
+   }
+   return i;
+}
+
+/* Release an extension.  Its rows stay in the arena until the next compaction. */
+void freeDeepIndex(uint32_t i) {
+   deepRows[i] = 0;
+   uint64_t top = atomic_load_explicit(&deepFreeHead, memory_order_relaxed);
+   do {
+      atomic_store_explicit(&deepFreeNext[i], (uint32_t) top, memory_order_relaxed);
+   } while (!atomic_compare_exchange_weak_explicit(&deepFreeHead, &top,
+                                                   (((top >> 32) + 1) << 32) | i,
+                                                   memory_order_release, memory_order_relaxed));
+}
+
+/* Extension record layout, in units of row:
+**   [0]     number of rows not yet used by process()
+**   [1]     number of rows already used, with EXT_STALE set if the
+**           successor lists were reordered after the extension was saved
+**   [2,3]   check value for the 2*period rows ending with the record's node
+**   [4...]  the rows of the extension packed into width bits each, followed
+**           by one spare word so that extRow() can always read two words
+** The rows leading up to the extension are not stored, since they are
+** already in the queue.
+*/
+#define EXT_LEFT 0
+#define EXT_USED 1
+#define EXT_HEADER 4
+#define EXT_STALE 0x8000
+#define EXTMAXROWS 0x7fff      /* longest extension, so EXT_USED never reaches EXT_STALE */
+#define EXTUSED(e) ((e)[EXT_USED] & ~EXT_STALE)
+#define EXTWORDS(n) (((uint32_t)(n) * (uint32_t)width + 15) >> 4)
+#define EXTLENGTH(n) (EXT_HEADER + EXTWORDS(n) + 1)
+
+/* Returns the ith unused row of extension e */
+static inline row extRow(const row *e, uint32_t i) {
+   uint32_t bit = (EXTUSED(e) + i) * (uint32_t) width;
+   const row *w = e + EXT_HEADER + (bit >> 4);
+   uint32_t v = w[0] | ((uint32_t) w[1] << 16);
+   return (row) ((v >> (bit & 15)) & ((1U << width) - 1));
+}
+
+/* Packs n rows into the words starting at w */
+void packRows(row *w, const row *r, uint32_t n) {
+   uint32_t i, bit = 0;
+   memset(w, 0, (EXTWORDS(n) + 1) * sizeof(*w));
+   for (i = 0; i < n; ++i, bit += width) {
+      uint32_t v = (uint32_t) r[i] << (bit & 15);
+      w[bit >> 4] |= (row) v;
+      w[(bit >> 4) + 1] |= (row) (v >> 16);
+   }
+}
+
+/* Check value for the 2*period rows starting at r */
+uint32_t rowCheck(const row *r) {
+   uint32_t h = 0;
+   int i;
+   for (i = 0; i < 2*period; ++i) {
+      h = (h * 269) + r[i] + 1;
+      h ^= h >> 13;
+   }
+   return h;
+}
+
+/* Check value for the 2*period rows ending with node x */
+uint32_t nodeCheck(node x) {
+   row r[2*MAXPERIOD];
+   int i;
+   for (i = 2*period - 1; i >= 0; --i) {
+      r[i] = ROW(x);
+      x = PARENT(x);
+   }
+   return rowCheck(r);
+}
+
+static inline uint32_t extCheck(const row *e) {
+   return e[2] | ((uint32_t) e[3] << 16);
+}
+
+static inline void setExtCheck(row *e, uint32_t h) {
+   e[2] = (row) h;
+   e[3] = (row) (h >> 16);
+}
+
+/* Write a copy of extension e without its used rows to dst */
+void copyExt(row *dst, const row *e) {
+   uint32_t i, bit = 0, n = e[EXT_LEFT];
+   dst[EXT_LEFT] = (row) n;
+   dst[EXT_USED] = e[EXT_USED] & EXT_STALE;
+   setExtCheck(dst, extCheck(e));
+   row *w = dst + EXT_HEADER;
+   memset(w, 0, (EXTWORDS(n) + 1) * sizeof(*w));
+   for (i = 0; i < n; ++i, bit += width) {
+      uint32_t v = (uint32_t) extRow(e, i) << (bit & 15);
+      w[bit >> 4] |= (row) v;
+      w[(bit >> 4) + 1] |= (row) (v >> 16);
+   }
+}
+
+/* Copy the extensions in the live part of the queue to new arenas, dropping */
+/* used rows and renumbering them in queue order, and release everything     */
+/* else.  Only call this when no other thread is using the extensions.       */
+void compactDeepRows(void) {
+   uint32_t i, n = 0;
+   size_t total = 0;
+   uint32_t oldNext = MIN(atomic_load_explicit(&deepNextIndex, memory_order_relaxed), DEEPLIMIT);
+   row **oldList = deepArenaList;
+   uint32_t oldCount = deepArenaCount;
+   row **moved;
+   
+   for (i = deepQHead; i < deepQTail && i < QSIZE; ++i)
+      if (deepRowIndices[i] > 1){
+         total += EXTLENGTH(deepRows[deepRowIndices[i]][EXT_LEFT]);
+         ++n;
+      }
+   moved = (row**)malloc((n + 1) * sizeof(*moved));
+   if (moved == 0){
+      fprintf(stderr, "Error: unable to allocate memory for depth-first extensions.\n");
+      exit(1);
+   }
+   
+   deepArenaList = 0;
+   deepArenaCount = deepArenaMax = 0;
+   trackMemory(MEM_EXTENSIONS, -deepArenaBytes);
+   deepArenaBytes = 0;
+   memset(deepThreadArena, 0, (params[P_NUMTHREADS] + 1) * sizeof(*deepThreadArena));
+   if (total) newDeepArena(&deepThreadArena[omp_get_thread_num()], total);
+   
+   n = 0;
+   for (i = deepQHead; i < deepQTail && i < QSIZE; ++i){
+      if (deepRowIndices[i] > 1){
+         row *e = deepRows[deepRowIndices[i]];
+         moved[n] = deepAlloc(EXTLENGTH(e[EXT_LEFT]));
+         copyExt(moved[n], e);
+         deepRowIndices[i] = n + 2;
+         ++n;
+      }
+   }
+   
+   for (i = 0; i < oldCount; ++i)
+      free(oldList[i]);
+   free(oldList);
+   
+   memset(deepRows, 0, oldNext * sizeof(*deepRows));
+   memcpy(deepRows + 2, moved, n * sizeof(*moved));
+   free(moved);
+   atomic_store_explicit(&deepFreeHead, 0, memory_order_relaxed);
+   atomic_store_explicit(&deepNextIndex, n + 2, memory_order_relaxed);
+}
+
 /* =================== */
 /*  Dump search state  */
 /* =================== */
@@ -1265,6 +2662,18 @@ int dumpFlag = 0;    /* Dump status flags, possible values follow */
 #define DUMPFAILURE (2)
 #define DUMPSUCCESS (3)
 
+/* Parts of the queue moved to disk by spillQueue() */
+typedef struct {
+   char file[256];
+   int depth;              /* depth of the first node to be processed */
+   unsigned long nodes;    /* number of nodes still to be processed */
+   int width;              /* 16 times the mean active width of those nodes */
+} spillShard;
+
+spillShard *shards = 0;
+int numShards = 0;
+int shardCap = 0;
+
 int dumpMode;  /* separate from params[P_DUMPMODE] for splitting */
 #define D_DISABLED   (0)
 #define D_OVERWRITE  (1)
@@ -1348,31 +2757,56 @@ void dumpState(void) {
       fprintf(fp,"1\n");
    else
       fprintf(fp,"%d\n",dumpNum%2);
+   fprintf(fp,"%d\n",numShards);
+   for (i = 0; i < (unsigned long long)numShards; ++i)
+      fprintf(fp,"%d %lu %d %s\n",shards[i].depth,shards[i].nodes,shards[i].width,shards[i].file);
+   /* the learned row order, if any, which saved extensions follow */
+   const uint16_t *order = loadedOrder;
+   if (order == 0 && params[P_REORDER] == ORDER_ADAPTIVE && rowCredit == 0)
+      order = valorder;
+   fprintf(fp,"%d\n",order != 0);
+   if (order)
+      for (i = 0; i < 1ULL << width; ++i)
+         fprintf(fp,"%"PRIu16"\n",order[i]);
+   row *ext = (row*)malloc(EXTLENGTH(UINT16_MAX) * sizeof(*ext));
+   if (ext == 0){      /* dumpFlag is still DUMPFAILURE; leave no partial dump */
+      fclose(fp);
+      remove(dumpFile);
+      return;
+   }
    fprintf(fp,"%"PRIu32"\n",qHead-qStart);
    fprintf(fp,"%"PRIu32"\n",qEnd-qStart);
    for (i = qStart; i < qEnd; ++i)
       fprintf(fp,"%"PRIu16"\n",rows[i]);
-   for (i = 0; i < QSIZE; ++i){
+   /* Only the live part of the extension queue can hold nonzero indices */
+   node deepEnd = MIN(deepQTail, QSIZE);
+   for (i = deepQHead; i < deepEnd; ++i){
       if (deepRowIndices[i]){
          if (deepRowIndices[i] > 1){
-            for (j = 0; j < deepRows[deepRowIndices[i]][0] + 1LU + 2LU; ++j){
-               fprintf(fp,"%"PRIu16"\n",deepRows[deepRowIndices[i]][j]);
-            }
+            /* write the unused rows in the same packed form as in memory */
+            copyExt(ext, deepRows[deepRowIndices[i]]);
+            fprintf(fp,"%"PRIu16"\n",(row)(ext[EXT_LEFT] | ext[EXT_USED]));  /* length and stale flag */
+            for (j = 2; j < EXTLENGTH(ext[EXT_LEFT]) - 1; ++j)
+               fprintf(fp,"%"PRIu16"\n",ext[j]);
          }
          else {
             fprintf(fp,"0\n");
             j = 0;
-            while (deepRowIndices[i] <= 1 && i < QSIZE){
+            while (i < deepEnd && deepRowIndices[i] <= 1){
                if (deepRowIndices[i] == 1) ++j;
                ++i;
             }
             fprintf(fp,"%llu\n",j);
-            if (i == QSIZE) break;
+            if (i == deepEnd) break;
             --i;
          }
       }
    }
-   fclose(fp);
+   free(ext);
+   if (ferror(fp) | fclose(fp)){
+      remove(dumpFile);
+      return;
+   }
    dumpFlag = DUMPSUCCESS;
 }
 
@@ -1399,79 +2833,219 @@ void putnum(long unsigned n) {
 }
 
 long currentDepth(void) {
-   long i;
-   node x;
-   x = qTail - 1;
-   i = 1;
-   while (x != 0) {
-      x = PARENT(x);
-      i++;
+   return genTop;
+}
+
+/* Print the memory in use by each part of the search */
+void printMemory(void) {
+   int k;
+   timeStamp();
+   printf("Memory in use:");
+   for (k = 0; k < NUM_MEMKINDS; ++k){
+      printf(" %s ", memKindName[k]);
+      putnum((unsigned long) atomic_load_explicit(&memUsed[k], memory_order_relaxed));
+      printf(k < NUM_MEMKINDS - 1 ? "B," : "B;");
    }
-   return i;
+   printf(" total ");
+   putnum((unsigned long) memoryInUse());
+   printf("B\n");
+   fflush(stdout);
 }
 
 /* doCompact() has two parts.  The first part compresses the
 ** queue.  The second part consists of the last loop which
 ** converts parent bits back to parent pointers.  The search
 ** state may be saved in between.
+**
+** Most of the passes are split into blocks of COMPACTBLOCK nodes
+** which are handled in parallel.  The results are identical to a
+** single-threaded pass over the queue.
 */
+#define COMPACTBLOCK (1LL<<16)
+
+#define KEEPBIT(k,y) ((atomic_load_explicit(&(k)[(y)>>6], memory_order_relaxed) >> ((y) & 63)) & 1)
+
 void doCompactPart1(void) {
    node x,y;
+   long long b;
    qEnd = qTail;
    
-   /* make a pass backwards from the end finding unused nodes at or before qHead */
-   x = qTail - 1;
-   y = qHead - 1;
-   while (y > 0) {
-      /* invariants: everything after y is still active.
-                     everything after x points to something after y.
-                     x is nonempty and points to y or something before y.
-                     so, if x doesn't point to y, y must be unused and can be removed. */
-      if (!EMPTY(y)) {
-         if (y > PARENT(x)) rows[y] = (row) -1;
-         else while (EMPTY(x) || PARENT(x) == y) x--;
+   /* Find unused nodes before qHead, working backwards one range at a time.
+   **
+   ** Parent pointers are nondecreasing, so the parents of the kept nodes in the
+   ** range [lo,hi) all lie in [lo',lo], where lo' is the parent of the first kept
+   ** node in [lo,hi).  A node in [lo',lo) is therefore kept only if it is marked
+   ** while scanning [lo,hi).  Everything at or after qHead is still active.
+   */
+   _Atomic uint64_t *keep = (_Atomic uint64_t *)calloc((qHead >> 6) + 1, sizeof(*keep));
+   if (keep == 0){
+      fprintf(stderr, "Error: unable to allocate memory for queue compaction.\n");
+      exit(1);
+   }
+   long long lo = qHead;
+   long long hi = qTail;
+   while (lo < hi) {
+      #pragma omp parallel for schedule(static) if (hi - lo > COMPACTBLOCK)
+      for (b = lo; b < hi; b++) {
+         node z = (node) b;
+         if (EMPTY(z)) continue;
+         if (z < qHead && z > 0 && !KEEPBIT(keep,z)) {
+            rows[z] = (row) -1;
+            continue;
+         }
+         node p = PARENT(z);
+         if (p < qHead)
+            atomic_fetch_or_explicit(&keep[p>>6], 1LLU << (p & 63), memory_order_relaxed);
       }
-      y--;
+      
+      /* next range ends where this one starts */
+      for (x = (node) lo; x < hi && EMPTY(x); x++);
+      if (x == hi) {    /* nothing kept, so nothing before this range is used */
+         for (y = 1; y < lo; y++) rows[y] = (row) -1;
+         break;
+      }
+      hi = lo;
+      lo = PARENT(x);
+   }
+   free(keep);
+   
+   long long nBlocks = (qTail + COMPACTBLOCK - 1) / COMPACTBLOCK;
+   node *blockParent = (node*)malloc((nBlocks + 1) * sizeof(*blockParent));
+   node *blockCount = (node*)malloc((nBlocks + 1) * sizeof(*blockCount));
+   if (blockParent == 0 || blockCount == 0){
+      fprintf(stderr, "Error: unable to allocate memory for queue compaction.\n");
+      exit(1);
    }
    
    /* make a pass forwards converting parent pointers to offset from prev parent ptr. */
    /* note that after unused nodes are eliminated, all these offsets are zero or one. */
+   /* Each block needs the parent of the last nonempty node before it, so collect   */
+   /* those first and then convert the blocks independently.                       */
+   #pragma omp parallel for schedule(static)
+   for (b = 0; b < nBlocks; b++) {
+      long long first = b * COMPACTBLOCK;
+      node z = (node) MIN(first + COMPACTBLOCK, (long long) qTail);
+      blockCount[b] = 0;
+      blockParent[b] = 0;
+      while (z-- > first) {
+         if (!EMPTY(z)) {
+            blockCount[b] = 1;
+            blockParent[b] = PARENT(z);
+            break;
+         }
+      }
+   }
    y = 0;
-   for (x = 0; x < qTail; x++) if (!EMPTY(x)) {
-      if (PARENT(x) == y) rows[x] = ROW(x);
-      else {
-         y = PARENT(x);
-         rows[x] = (1<<width) + ROW(x);
+   for (b = 0; b < nBlocks; b++) {
+      node t = blockParent[b];
+      int nonempty = blockCount[b];
+      blockParent[b] = y;
+      if (nonempty) y = t;
+   }
+   #pragma omp parallel for schedule(static) private(x,y)
+   for (b = 0; b < nBlocks; b++) {
+      long long last = MIN((b + 1) * COMPACTBLOCK, (long long) qTail);
+      y = blockParent[b];
+      for (x = (node) (b * COMPACTBLOCK); x < last; x++) if (!EMPTY(x)) {
+         if (PARENT(x) == y) rows[x] = ROW(x);
+         else {
+            y = PARENT(x);
+            rows[x] = (1<<width) + ROW(x);
+         }
       }
    }
    
-   /* Make a pass backwards compacting gaps.
+   /* Compact gaps, packing everything against the end of the queue.
    **
    ** For most times we run this, it could be combined with the next phase, but
    ** every once in a while the process of repacking the remaining items causes them
    ** to use *MORE* space than they did before they were repacked (because of the need
    ** to leave empty space when ROFFSET gets too big) and without this phase the repacked
    ** stuff overlaps the not-yet-repacked stuff causing major badness.
-   ** 
-   ** For this phase, y points to the current item to be repacked, and x points
-   ** to the next free place to pack an item.
+   **
+   ** Each block is first packed against its own end.  A prefix sum over the block
+   ** counts then gives the final location of each block, and the blocks are moved
+   ** there starting from the end of the queue.
    */
-   x = y = qTail-1;
-   for (;;) {
-      if (qHead == y) qHead = x;
-      if (!EMPTY(y)) {
-         rows[x] = rows[y];
-         x--;
+   node after = 0;   /* number of nonempty nodes after qHead */
+   #pragma omp parallel for schedule(static) private(x,y)
+   for (b = 0; b < nBlocks; b++) {
+      long long first = b * COMPACTBLOCK;
+      long long last = MIN(first + COMPACTBLOCK, (long long) qTail);
+      node headCount = 0;
+      x = y = (node) last;
+      while (y > first) {
+         --y;
+         if (!EMPTY(y)) {
+            if (y > qHead) ++headCount;
+            rows[--x] = rows[y];
+         }
       }
-      if (y-- == 0) break;    /* circumlocution for while (y >= 0) because x is unsigned */
+      blockCount[b] = (node) (last - x);
+      if (first <= qHead && qHead < last) after = headCount;
+   }
+   for (b = qHead / COMPACTBLOCK + 1; b < nBlocks; b++)
+      after += blockCount[b];
+   
+   x = qTail;
+   for (b = nBlocks - 1; b >= 0; b--) {
+      long long last = MIN((b + 1) * COMPACTBLOCK, (long long) qTail);
+      x -= blockCount[b];
+      if (x != last - blockCount[b])
+         memmove(rows + x, rows + last - blockCount[b], blockCount[b] * sizeof(*rows));
+   }
+   free(blockParent);
+   free(blockCount);
+   
+   qHead = qTail - 1 - after;
+   qStart = x;       /* mark start of queue */
+}
+
+/* Rebuild the hash table from the whole queue.  Threads take blocks of
+** nodes, and a slot is only overwritten by a later node, so each slot
+** ends up holding the last node that hashes to it.  That is what calling
+** setVisited() on every node in order gives, whatever the number of
+** threads.
+*/
+void rebuildHash(void) {
+   _Atomic node *h = (_Atomic node *)hash;
+   long long b, end = MIN((long long) qTail, (long long) QSIZE);
+   
+   if (hash == 0) return;
+   #pragma omp parallel for schedule(static)
+   for (b = 0; b < (long long) HASHSIZE; b += COMPACTBLOCK)
+      memset(hash + b, 0, MIN(COMPACTBLOCK, (long long) HASHSIZE - b) * sizeof(*hash));
+   
+   #pragma omp parallel for schedule(static, COMPACTBLOCK) if (end > COMPACTBLOCK)
+   for (b = 0; b < end; b++) {
+      node z = (node) b;
+      if (EMPTY(z)) continue;
+      long k = hashFunction(PARENT(z), ROW(z));
+      node cur = atomic_load_explicit(&h[k], memory_order_relaxed);
+      while (cur < z && !atomic_compare_exchange_weak_explicit(&h[k], &cur, z,
+                                   memory_order_relaxed, memory_order_relaxed));
    }
-   qStart = ++x;     /* mark start of queue */
 }
 
 void doCompactPart2(void) {
    node x,y;
    uint32_t i, j;
-   int k;
+   uint32_t n, theDeepIndex;
+   
+   /* Pack nonzero depth-first extension indices to the start of the extension */
+   /* queue.  Only the live part of the queue can hold nonzero indices, so the */
+   /* cost of this and of the respacing below grows with the live nodes rather */
+   /* than with QSIZE.                                                         */
+   n = 0;
+   for (i = deepQHead; i < deepQTail && i < QSIZE; ++i){
+      if (deepRowIndices[i]){
+         j = deepRowIndices[i];
+         deepRowIndices[i] = 0;
+         deepRowIndices[n++] = j;
+      }
+   }
+   deepQHead = 0;
+   deepQTail = n;    /* enqueue() only clears entries past the packed indices */
    
    /* Make a pass forwards converting parent bits back to parent pointers.
    ** 
@@ -1481,7 +3055,6 @@ void doCompactPart2(void) {
    ** and all items after x are nonempty. 
    */
    qTail = 0; y = 0;
-   resetHash();
    for (x = qStart; x < qEnd; x++) {
       if (ROFFSET(x)) {   /* skip forward to next parent */
          y++;
@@ -1490,62 +3063,49 @@ void doCompactPart2(void) {
       enqueue(y,ROW(x));
       //if (aborting) return;    /* why is this here? value of aborting is not changed by enqueue(). */
       if (qHead == x) qHead = qTail - 1;
-      setVisited(qTail - 1);
    }
    rephase();
    
-   /* Repack nonzero depth-first extension indices to the end of the queue */
-   j = QSIZE - 1;
-   for (i = QSIZE; i > 0; --i){
-      if (deepRowIndices[i - 1]){
-         deepRowIndices[j] = deepRowIndices[i - 1];
-         deepRowIndices[i - 1] = 0;
-         --j;
-      }
-   }
+   /* The placement of each node depends on the one before, so the pass  */
+   /* above stays serial.  The hash lookups walk 2*period ancestors per  */
+   /* node and are the larger cost, so the hash is rebuilt in parallel. */
+   rebuildHash();
    
-   /* Sanity check: extension queue should not take up all available space */
-   if (deepRowIndices[0]){
-      fprintf(stderr,"Error: extension queue has too many elements.\n");
-      exit(1);
+   /* Find the node which receives the last extension index */
+   i = 0;
+   for (x = qHead; x < qTail && i < n; ++x)
+      if (!EMPTY(x)) ++i;
+   
+   /* Discard indices for which there is no node (should not happen) */
+   for (j = i; j < n; ++j){
+      if (deepRowIndices[j] > 1)
+         freeDeepIndex(deepRowIndices[j]);
+      deepRowIndices[j] = 0;
    }
    
-   /* Respace depth-first extension queue to match node queue */
-   i = 0;
-   j = 0;
-   while (!deepRowIndices[j] && j < QSIZE) ++j;
-   for (x = qHead; x < qTail && j < QSIZE; ++x){
-      if (EMPTY(x)){
-         ++i;
-         continue;
-      }
-      
-      deepRowIndices[i] = deepRowIndices[j];
+   /* Respace depth-first extension queue to match node queue, working  */
+   /* backwards so that no index is overwritten before it has been moved */
+   j = i;
+   while (j > 0){
+      --x;
+      if (EMPTY(x)) continue;
+      --j;
+      theDeepIndex = deepRowIndices[j];
+      deepRowIndices[j] = 0;
+      i = x - qHead;
+      deepRowIndices[i] = theDeepIndex;
       
       /* Sanity check: do the extension rows match the node rows? */
-      if (deepRowIndices[j] > 1){
-         y = x;
-         for (k = 0; k < 2*period; ++k){
-            uint16_t startRow = deepRows[deepRowIndices[j]][1] + 1;
-            if (deepRows[deepRowIndices[j]][startRow - k] != ROW(y)){
-               fprintf(stderr, "Warning: non-matching rows detected at node %u in doCompactPart2()\n",x);
-               free(deepRows[deepRowIndices[j]]);
-               deepRows[deepRowIndices[j]] = 0;
-               deepRowIndices[i] = 0;
-               break;
-            }
-            y = PARENT(y);
-         }
+      if (deepRowIndices[i] > 1 && extCheck(deepRows[deepRowIndices[i]]) != nodeCheck(x)){
+         fprintf(stderr, "Warning: non-matching rows detected at node %u in doCompactPart2()\n",x);
+         freeDeepIndex(deepRowIndices[i]);
+         deepRowIndices[i] = 0;
       }
-      if (j > i) deepRowIndices[j] = 0;
-      ++i;
-      ++j;
-   }
-   for (j = qTail - qHead; j < QSIZE; ++j){
-      deepRowIndices[j] = 0;
    }
    deepQHead = 0;
    deepQTail = qTail - qHead;
+   
+   compactDeepRows();
 }
 
 void doCompact(void) {
@@ -1595,149 +3155,1811 @@ void setkey(int h, int v) {
 }
 #endif
 
+/* ============================== */
+/*  Evicting the lookup table     */
+/* ============================== */
+
+/* Once a new table segment takes memory use past the limit, evictTable()
+** copies the parts of the lookup table used since the last eviction into
+** new segments and drops the rest; getoffset() rebuilds a dropped part the
+** next time it is needed.  The parts kept are marked cold in gInd3, so the
+** first lookup of each after an eviction goes through makeRow(), which
+** clears the mark instead of the lookup itself recording every use.
+**
+** Only half of the memory left for the table by everything else is kept,
+** so the table has to grow by the other half before the next eviction.  If
+** that leaves less than EVICTFLOOR segments, evicting cannot keep memory use
+** below the limit and the search is aborted as without eviction.  Pointers
+** into the table are held by depth-first searches and the lookahead caches,
+** so this is only called when no search is running (deepen() ends early
+** once an eviction is pending), and the caches are cleared.
+*/
+#define EVICTFLOOR 4
+void evictTable(void) {
+   uint16_t **oldSegs = (uint16_t **)malloc(tableSegMax * sizeof(*oldSegs));
+   uint32_t oldCount = numTableSegs, i;
+   long long row12, kept = 0, dropped = 0;
+   long long target = (memlimit - (memoryInUse() - tableSegBytes)) / 2;
+   
+   if (target < (long long)EVICTFLOOR << (tableSegBits + 1)){
+      printMemory();
+      printf("Aborting due to excessive memory usage outside the lookup table\n");
+      exit(1);
+   }
+   
+   if (oldSegs == 0){
+      fprintf(stderr, "Error: unable to allocate memory for lookup table.\n");
+      exit(1);
+   }
+   memcpy(oldSegs, tableSegs, tableSegMax * sizeof(*oldSegs));
+   memset(tableSegs, 0, tableSegMax * sizeof(*tableSegs));
+   numTableSegs = 0;
+   trackMemory(MEM_TABLES, -tableSegBytes);
+   tableSegBytes = 0;
+   bbuf_left = 0;
+   memset(rowHash, 0, (rowHashMask + 1) * sizeof(*rowHash));
+   rowHashCount = 0;
+   
+   for (row12 = 0; row12 < 1LL<<(2*width); ++row12){
+      uint32_t r = atomic_load_explicit(&gInd3[row12], memory_order_relaxed);
+      if (r == 0) continue;
+      if ((r & TABLECOLD) || tableSegBytes >= target){
+         atomic_store_explicit(&gInd3[row12], 0, memory_order_relaxed);
+         ++dropped;
+         continue;
+      }
+      uint16_t *oldRow = oldSegs[r >> tableSegBits] + (r & ((1U << tableSegBits) - 1));
+      int siz = tableRowSize(oldRow);
+      uint32_t off = bmalloc(siz, !DENSEROW(oldRow));
+      memcpy(TABLEROW(off), oldRow, 2*siz);
+      off = shareRow((int)row12, off, siz);
+      atomic_store_explicit(&gInd3[row12], off | TABLECOLD, memory_order_relaxed);
+      ++kept;
+   }
+   
+   for (i = 0; i < oldCount; ++i)
+      free(oldSegs[i]);
+   free(oldSegs);
+   
+#ifndef NOCACHE
+   if (params[P_CACHEMEM])
+      memset(totalCache, 0, sizeof(*totalCache) * (cachesize + 5) * params[P_NUMTHREADS]);
+#endif
+   
+   evictPending = 0;
+   ++tableEvictions;
+   timeStamp();
+   printf("Memory limit reached, lookup table eviction %lld: kept ", tableEvictions);
+   putnum(kept);
+   printf(", evicted ");
+   putnum(dropped);
+   printf("\n");
+   fflush(stdout);
+   tableEvicted += dropped;
+}
+
+/* ================================= */
+/*  Dead ends found by depthFirst()  */
+/* ================================= */
+
+/* The dead-end table remembers windows of 2*period rows from which
+** depthFirst() could not add a given number of rows.  A window that fails
+** to reach some depth also fails for any greater depth, so each entry
+** keeps the smallest number of rows known to be impossible.
+**
+** The table is shared by all threads without locks.  Each entry stores
+** its key xored with its data, so an entry torn by a concurrent write
+** simply fails to match.  Keys are 64-bit hashes of the window and its
+** phase.
+*/
+#define memoBits params[P_MEMOBITS]
+#define MEMOSIZE (1LLU<<memoBits)
+
+#ifdef QSIMPLE
+   #define MEMOPHASE(p) 0     /* pPhase is not kept up to date for QSIMPLE */
+#else
+   #define MEMOPHASE(p) (p)
+#endif
+
+typedef struct {
+   _Atomic uint64_t check;    /* key ^ data */
+   _Atomic uint64_t data;     /* number of rows known to be impossible */
+} memoEntry;
+
+typedef struct {
+   long long lookups, hits, stores, evictions;
+   char pad[32];              /* keep counters of different threads apart */
+} memoCounters;
+
+memoEntry *memo = 0;
+memoCounters *memoStats = 0;
+
+void allocMemo(void) {
+   if (memoBits == 0) return;
+   memo = (memoEntry*)calloc(MEMOSIZE, sizeof(*memo));
+   memoStats = (memoCounters*)calloc(params[P_NUMTHREADS] + 1, sizeof(*memoStats));
+   if (memo == 0 || memoStats == 0){
+      printf("Unable to allocate dead-end table, dead-end detection disabled\n");
+      free(memo);
+      free(memoStats);
+      memo = 0;
+      memoStats = 0;
+   }
+   else trackMemory(MEM_OTHER, MEMOSIZE*sizeof(*memo) + (params[P_NUMTHREADS] + 1)*sizeof(*memoStats));
+}
+
+static inline uint64_t memoKey(const row *r, int p) {
+   uint64_t h = (0xcbf29ce484222325ULL ^ (uint64_t) p) * 0x100000001b3ULL;
+   int i;
+   for (i = 0; i < 2*period; ++i)
+      h = (h ^ r[i]) * 0x100000001b3ULL;
+   h ^= h >> 29;
+   h *= 0xbf58476d1ce4e5b9ULL;
+   return h ^ (h >> 32);
+}
+
+/* Is it known that no rows can be added after the window ending at r[-1]? */
+static inline int memoDead(const row *r, int p, uint32_t remaining) {
+   uint64_t key = memoKey(r - 2*period, p);
+   memoEntry *e = &memo[key & (MEMOSIZE - 1)];
+   memoCounters *m = &memoStats[omp_get_thread_num()];
+   uint64_t d = atomic_load_explicit(&e->data, memory_order_relaxed);
+   ++m->lookups;
+   if ((atomic_load_explicit(&e->check, memory_order_relaxed) ^ d) == key && d <= remaining){
+      ++m->hits;
+      return 1;
+   }
+   return 0;
+}
+
+/* Record that remaining rows cannot be added after the window ending at r[-1] */
+static inline void memoStore(const row *r, int p, uint32_t remaining) {
+   uint64_t key = memoKey(r - 2*period, p);
+   memoEntry *e = &memo[key & (MEMOSIZE - 1)];
+   memoCounters *m = &memoStats[omp_get_thread_num()];
+   uint64_t d = atomic_load_explicit(&e->data, memory_order_relaxed);
+   uint64_t c = atomic_load_explicit(&e->check, memory_order_relaxed);
+   if ((c ^ d) == key){
+      if (d <= remaining) return;
+   }
+   else if (c | d) ++m->evictions;
+   ++m->stores;
+   atomic_store_explicit(&e->data, remaining, memory_order_relaxed);
+   atomic_store_explicit(&e->check, key ^ remaining, memory_order_relaxed);
+}
+
+/* ============================== */
+/*  Branch order                  */
+/* ============================== */
+
+/* With --branch-order, depth-first searches try the rows of each successor
+** list in order of the number of rows that lookAhead() finds in its first
+** lookup.  That lookup is in one part of the table for the whole list, so
+** the counts cost one read each.  fewest tries the most constrained rows
+** first and most the least constrained, so the search can reach a passing
+** extension sooner.  Rows with no successors go last either way.
+**
+** The sorted lists are copies kept per thread, at a fixed place for each
+** row of the search.  The order only depends on the rows already placed,
+** so saved extensions stay valid: process() and reloadDepthFirst() sort
+** the lists the same way before looking for the saved rows.
+*/
+typedef struct {
+   uint16_t *lists;        /* the list for row a of a search starts at lists + (a << width) */
+   uint32_t *key;
+   uint16_t *tmp;
+   uint32_t levels;
+} branchBuffer;
+
+branchBuffer *branchBufs = 0;   /* one per thread, only with --branch-order */
+
+void allocBranches(void) {
+   if (params[P_BRANCH] == BRANCH_TABLE) return;
+   branchBufs = (branchBuffer*)calloc(params[P_NUMTHREADS], sizeof(*branchBufs));
+   if (branchBufs == 0){
+      fprintf(stderr, "Error: unable to allocate memory for branch ordering.\n");
+      exit(1);
+   }
+}
+
+/* Make room in this thread's buffer for searches using rows below n. */
+/* Must not be called during a search, since the lists may move.      */
+void branchReserve(uint32_t n) {
+   if (!branchBufs) return;
+   branchBuffer *b = &branchBufs[omp_get_thread_num()];
+   if (b->levels >= n) return;
+   if (!b->key){
+      b->key = (uint32_t*)malloc(sizeof(*b->key) << width);
+      b->tmp = (uint16_t*)malloc(sizeof(*b->tmp) << width);
+   }
+   free(b->lists);
+   b->lists = (uint16_t*)malloc(((size_t)n << width) * sizeof(*b->lists));
+   if (!b->key || !b->tmp || !b->lists){
+      fprintf(stderr, "Error: unable to allocate memory for branch ordering.\n");
+      exit(1);
+   }
+   trackMemory(MEM_OTHER, ((long long)(n - b->levels) << width) * sizeof(*b->lists)
+                          + (b->levels ? 0 : (sizeof(*b->key) + sizeof(*b->tmp)) << width));
+   b->levels = n;
+}
+
 /* ========================== */
 /*  Primary search functions  */
 /* ========================== */
 
+/* A depth-first search which has been split between threads */
+typedef struct {
+   node theNode;
+   _Atomic int pending;    /* number of pieces still running */
+   _Atomic int found;      /* set when some piece finds an extension */
+} dfsJob;
+
+/* State of one piece of a depth-first search */
+typedef struct {
+   node theNode;
+   uint32_t startRow;      /* first row after theNode */
+   uint32_t baseRow;       /* the piece is done when it backs up past this row */
+   uint32_t dirtyLevel;    /* searches at this row and above are not complete */
+   uint32_t staleLevel;    /* rows below this were reloaded from a stale extension */
+   uint32_t pruneRow;      /* row checked by --prune-subperiodic, or 0 */
+   uint32_t howDeep;
+   int startPhase;         /* phase of startRow */
+   int earlyExit;
+   uint16_t **pInd;
+   int *pRemain;
+   row *pRows;
+   _Atomic int *remainingItems;
+   _Atomic int *forceExit;
+   _Atomic int *passed;
+   dfsJob *job;            /* null until part of the search is given away */
+   int probe;              /* speculative search: save nothing, give up when told to */
+} dfsContext;
+
+#define STEAL_CLOSED (-2)  /* values of stealSlot.request other than thread numbers */
+#define STEAL_OPEN (-1)
+#define STEAL_WAIT 0       /* values of stealSlot.reply */
+#define STEAL_WORK 1
+#define STEAL_NONE 2
+
+typedef struct {
+   _Atomic int request;    /* thread asking this one for work, STEAL_OPEN or STEAL_CLOSED */
+   _Atomic int reply;      /* answer to this thread's own request */
+   dfsContext gift;        /* work handed to this thread */
+   uint16_t *giftEnd;      /* with --branch-order, a copy in this thread's own lists */
+   int giftCount;
+   row *rows;              /* this thread's pRows array */
+   char pad[64];           /* keep slots of different threads apart */
+} stealSlot;
+
+stealSlot *stealSlots = 0;    /* nonzero only while deepening with work stealing */
+_Atomic int stealActive;      /* number of threads running part of a depth-first search */
+
+/* Speculative deepening: while thread 0 runs the breadth-first search, the */
+/* other threads search nodes further along the queue and set the bit of   */
+/* each node that has no extension, so that it is dropped rather than      */
+/* processed when the breadth-first search gets to it.                     */
+_Atomic uint64_t *probeBits = 0;   /* one bit per queue entry, cleared before each run */
+_Atomic long long probeNext;       /* next node to search */
+_Atomic long long probeHead;       /* qHead and qTail as last seen by the searches */
+_Atomic long long probeLimit;
+_Atomic int probeStop;
+_Atomic long long probesRun, probesPruned;
+long long probesDropped = 0;       /* pruned nodes the breadth-first search never processed */
+_Atomic long long subperiodCuts[2];   /* queue nodes and depth-first branches cut by --prune-subperiodic */
+
+/* States seen by one thread during iterative deepening */
+#define PATHHASHSIZE 4096     /* buckets for the states on the current path */
+#define SEENSIZE (1<<20)      /* states searched, one per bucket */
+typedef struct {
+   uint32_t *pathHead;     /* latest row of the path ending a state in each bucket */
+   uint32_t *pathNext;     /* for each row of the path, the one before it in its bucket */
+   row *rows;              /* the last state searched in each bucket */
+   uint32_t *depth;        /* the depth it was searched at, or 0 if none */
+   uint32_t *pass;         /* and in which pass */
+   uint32_t thisPass;
+} iddfsTables;
+
 void process(node theNode);
 int depthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *remainingItems, _Atomic int *forceExit, _Atomic int *passed);
+int probeDepthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *stop);
+int iddfsNode(node root, uint32_t bound, uint32_t prevBound, uint16_t **pInd, int *pRemain, row *pRows,
+              iddfsTables *t, _Atomic int *pause);
+int probeRows(uint32_t startRow, int pPhase, uint16_t howDeep, uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *stop);
+int lookAhead(row *pRows, int a, int pPhase);
+void donateWork(dfsContext *c, uint32_t currRow);
+void stealWork(uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *remainingItems, _Atomic int *forceExit, _Atomic int *passed);
+
+/* ================================================================== */
+/* Adaptive deepening: after every deepening step, move the increment */
+/* one step in whichever direction last improved the number of queue  */
+/* entries removed per second of depth-first search.  The increment  */
+/* stays between MINDEEP and params[P_ADAPTDEEP].                     */
+/* ================================================================== */
+
+int adaptIncrement = 0;       /* 0 until the first deepening step */
+int adaptDirection = 1;
+double adaptLastRate = -1.0;  /* negative until the first measurement */
+
+static int deepIncrement(void){
+   if (!params[P_ADAPTDEEP]) return MINDEEP;
+   if (adaptIncrement == 0) adaptIncrement = MINDEEP;
+   return adaptIncrement;
+}
+
+/* live: unpruned leaves before/after the depth-first searches         */
+/* size: queue entries before/after compaction                         */
+static void adaptDeepening(long long liveBefore, long long liveAfter,
+                           long long sizeBefore, long long sizeAfter, double seconds){
+   double rate = (double)(sizeBefore - sizeAfter) / MAX(seconds, 1e-3);
+   int oldIncrement = adaptIncrement;
+   const char *reason;
+   
+   if (adaptLastRate < 0.0)
+      reason = "first measurement";
+   else if (rate < adaptLastRate){
+      adaptDirection = -adaptDirection;
+      reason = "rate fell, reversing";
+   }
+   else
+      reason = "rate rose, continuing";
+   adaptLastRate = rate;
+   
+   adaptIncrement += adaptDirection * MAX(1, adaptIncrement / 4);
+   if (adaptIncrement <= MINDEEP){
+      adaptIncrement = MINDEEP;
+      adaptDirection = 1;
+      reason = "at minimum";
+   }
+   else if (adaptIncrement >= params[P_ADAPTDEEP]){
+      adaptIncrement = params[P_ADAPTDEEP];
+      adaptDirection = -1;
+      reason = "at maximum";
+   }
+   
+   timeStamp();
+   printf("Adaptive deepening: %.1f%% pruned, shrink ratio %.3f, %.2fs, %.0f entries/s; "
+          "increment %d -> %d (%s)\n",
+          liveBefore ? 100.0 * (double)(liveBefore - liveAfter) / (double)liveBefore : 0.0,
+          sizeBefore ? (double)sizeAfter / (double)sizeBefore : 1.0,
+          seconds, rate, oldIncrement, adaptIncrement, reason);
+}
+
+static long long liveLeaves(void){
+   long long j, n = 0;
+   for (j = qHead; j < qTail; ++j)
+      if (!EMPTY(j)) ++n;
+   return n;
+}
+
+/* Report successful/unsuccessful dump */
+static void reportDump(void) {
+   if (dumpFlag == DUMPSUCCESS) {
+      timeStamp();
+      printf("State dumped to %s\n",dumpFile);
+      if (dumpNum == DUMPLIMIT){
+         timeStamp();
+         printf("Sequential dump limit reached.  Changing to overwrite mode.\n");
+      }
+   }
+   else if (dumpFlag == DUMPFAILURE) {
+      timeStamp();
+      printf("State dump unsuccessful\n");
+      if (dumpMode == D_OVERWRITE)
+         dumpNum--;   /* reset dumpNum so that the next dump doesn't overwrite our "backup" */
+   }
+   dumpFlag = DUMPRESET;
+}
 
 static void deepen(void) {
    /* compute amount to deepen, apply reduction if too deep */
    int deepeningAmount;
    int i = currentDepth();
+   int increment = deepIncrement();
+   long long liveBefore = 0, liveAfter = 0, sizeBefore = qTail;
+   double startTime = 0.0, seconds = 0.0;
    
-   if (i >= lastDeep) deepeningAmount = MINDEEP;
-   else deepeningAmount = lastDeep + MINDEEP - i;   /* go at least MINDEEP deeper */
+   if (i >= lastDeep) deepeningAmount = increment;
+   else deepeningAmount = lastDeep + increment - i;   /* go at least increment deeper */
    
    if (params[P_FIRSTDEEP]){
       deepeningAmount = params[P_FIRSTDEEP];
       params[P_FIRSTDEEP] = 0;
    }
-   
-   lastDeep = i + deepeningAmount;
-   
-   /* report what's happening */
-   printf("%d, deepening %d, ", i, deepeningAmount);
-   putnum(qTail - qHead);
-   printf("/");
-   putnum(qTail);
+   
+   lastDeep = i + deepeningAmount;
+   
+   /* report what's happening */
+   printf("%d, deepening %d, ", i, deepeningAmount);
+   putnum(qTail - qHead);
+   printf("/");
+   putnum(qTail);
+   fflush(stdout);
+   
+   _Atomic int remainingItems = 0;
+   _Atomic int forceExit = 0;
+   _Atomic int passed = 0;
+   atomic_store_explicit(&remainingItems, qTail - qHead, memory_order_seq_cst);
+   atomic_store_explicit(&forceExit, 0, memory_order_seq_cst);
+   atomic_store_explicit(&passed, 0, memory_order_seq_cst);
+   deepenStop = &forceExit;
+
+   if (params[P_WORKSTEAL] && params[P_NUMTHREADS] > 1){
+      stealSlots = (stealSlot*)calloc(params[P_NUMTHREADS], sizeof(*stealSlots));
+      if (stealSlots == 0){
+         fprintf(stderr, "Error: unable to allocate memory for work stealing.\n");
+         exit(1);
+      }
+      int t;
+      for (t = 0; t < params[P_NUMTHREADS]; ++t)
+         atomic_init(&stealSlots[t].request, STEAL_CLOSED);
+   }
+   atomic_store_explicit(&stealActive, 0, memory_order_seq_cst);
+   
+   if (params[P_ADAPTDEEP]){
+      liveBefore = liveLeaves();
+      startTime = wallClock();
+   }
+   
+   /* go through queue, deepening each one */
+   #pragma omp parallel
+   {
+      uint16_t **pInd;
+      int *pRemain;
+      row *pRows;
+      
+      pInd = (uint16_t**)calloc((deepeningAmount + 4 * params[P_PERIOD]), sizeof(*pInd));
+      pRemain = (int*)calloc((deepeningAmount + 4 * params[P_PERIOD]), sizeof(*pRemain));
+      pRows = (row*)calloc((deepeningAmount + 4 * params[P_PERIOD]), sizeof(*pRows));
+      branchReserve(deepeningAmount + 4 * params[P_PERIOD]);
+      
+      if (stealSlots){
+         stealSlots[omp_get_thread_num()].rows = pRows;
+         atomic_fetch_add_explicit(&stealActive, 1, memory_order_relaxed);
+      }
+      #pragma omp barrier
+      
+      long long j;
+      #pragma omp for schedule(dynamic, CHUNK_SIZE) nowait
+      for (j = qHead; j < qTail; j++) {
+         uint32_t *d = &deepRowIndices[deepQHead + j - qHead];
+         if (EMPTY(j)) ;
+         else if (atomic_load_explicit(&forceExit, memory_order_relaxed)){
+            if (*d == 0) *d = 1;    /* kept unsearched, as by an early exit */
+         }
+         else if (!depthFirst((node)j, (uint16_t)deepeningAmount, pInd, pRemain, pRows, &remainingItems, &forceExit, &passed))
+            MAKEEMPTY(j);
+         atomic_fetch_sub_explicit(&remainingItems, 1, memory_order_relaxed);
+      }
+      
+      /* help with the searches that are still running */
+      if (stealSlots){
+         atomic_fetch_sub_explicit(&stealActive, 1, memory_order_release);
+         stealWork(pInd, pRemain, pRows, &remainingItems, &forceExit, &passed);
+      }
+      free(pInd);
+      free(pRemain);
+      free(pRows);
+   }
+   
+   free(stealSlots);
+   stealSlots = 0;
+   deepenStop = 0;
+   
+   if (params[P_ADAPTDEEP]){
+      seconds = wallClock() - startTime;
+      liveAfter = liveLeaves();
+   }
+   
+   /* before reporting new queue size, shrink tree back down */
+   printf(" -> ");
+   fflush(stdout);
+   
+   /* signal time for dump (iterativeDeepening() only dumps between passes) */
+   if (params[P_DUMPMODE] != D_DISABLED && !params[P_IDDFS] && time(NULL) - lastDumpTime >= params[P_DUMPINTERVAL]){
+      dumpFlag = DUMPPENDING;
+      time(&lastDumpTime);
+   }
+   
+   doCompact();
+   
+   /* now finish report */
+   putnum(qTail - qHead);
+   printf("/");
+   putnum(qTail);
+   printf(", extensions ");
+   putnum(deepArenaBytes);
+   printf("B\n");
+   if (params[P_MEMBUDGET]) printMemory();
+   
+   reportDump();
+   
+   if (params[P_ADAPTDEEP])
+      adaptDeepening(liveBefore, liveAfter, sizeBefore, qTail, seconds);
+   if (rowCredit)
+      reorderRows();
+   
+   fflush(stdout);
+}
+
+/* ============================ */
+/*  Spilling the queue to disk  */
+/* ============================ */
+
+/* When the queue nears the end of its memory, spillQueue() picks the
+** shallowest generation at which the nodes waiting in the queue have more than
+** one ancestor, and moves the subtrees of the later half of that generation to
+** a shard file.  A shard holds the nodes to be processed together with all of
+** their ancestors, each as a row and the position of its parent in the shard,
+** so it can be loaded into an empty queue on its own.  This goes on until the
+** queue is at most half full, and replaces both the deepening that is forced
+** at QSIZE - QSIZE/16 and the abort in qFull().  breadthFirst() loads the
+** shard with the shallowest nodes whenever the queue in memory runs out.
+** Shard files are left on disk when dumps are enabled, since the dumps list the
+** shards that were waiting when they were made.
+**
+** With --best-first the shards form a frontier ranked by a heuristic, and the
+** queue in memory holds the most promising part of the search.  The queue is
+** spilled as above, and the best shard is restored whenever the queue runs
+** out.  At the start of each generation the waiting nodes are also ranked
+** against the best shard, and if the shard ranks higher the whole queue is
+** spilled and the shard restored in its place.  depth ranks the deepest
+** nodes highest.  width ranks the narrowest active rows on average highest,
+** and also spills the subtrees whose waiting nodes are widest.  Within the
+** queue the nodes are still expanded in breadth-first order.
+*/
+
+#define SPILLBIT(k,y) (((k)[(y)>>6] >> ((y) & 63)) & 1)
+#define SETSPILLBIT(k,y) ((k)[(y)>>6] |= 1LLU << ((y) & 63))
+
+static node ancestorAt(node x, int d) {
+   int i;
+   for (i = nodeDepth(x); i > d; --i)
+      x = PARENT(x);
+   return x;
+}
+
+/* Number of columns spanned by the last 2*period rows ending with node x */
+static int activeWidth(node x) {
+   row r = 0;
+   int i;
+   for (i = 0; i < 2*period && x; ++i, x = PARENT(x))
+      r |= ROW(x);
+   return r ? 32 - __builtin_clz(r) - __builtin_ctz(r) : 0;
+}
+
+typedef struct {
+   double width;
+   node x;
+} subtreeWidth;
+
+static int compareWidth(const void *a, const void *b) {
+   const subtreeWidth *u = (const subtreeWidth*)a, *v = (const subtreeWidth*)b;
+   if (u->width != v->width) return u->width < v->width ? 1 : -1;   /* widest first */
+   return u->x < v->x ? -1 : u->x > v->x;
+}
+
+/* Mark in sub the nodes of generation d, whose descendants waiting in the   */
+/* queue lie from lo to hi, whose subtrees have the widest waiting nodes,    */
+/* up to about half of all waiting nodes.  Returns 0 if there is only one.   */
+static int widestSubtrees(uint64_t *sub, int d, node lo, node hi) {
+   node n = hi - lo + 1, x, y;
+   double *sum = (double*)calloc(n, sizeof(*sum));
+   uint32_t *count = (uint32_t*)calloc(n, sizeof(*count));
+   subtreeWidth *order = (subtreeWidth*)malloc(n * sizeof(*order));
+   uint64_t waiting = 0, spilled = 0;
+   node m = 0, i;
+   
+   if (sum == 0 || count == 0 || order == 0){
+      free(sum);
+      free(count);
+      free(order);
+      return 0;
+   }
+   for (x = qHead; x < qTail; ++x){
+      if (EMPTY(x)) continue;
+      y = ancestorAt(x, d) - lo;
+      sum[y] += activeWidth(x);
+      ++count[y];
+      ++waiting;
+   }
+   for (y = 0; y < n; ++y){
+      if (!count[y]) continue;
+      order[m].width = sum[y] / count[y];
+      order[m++].x = y;
+   }
+   qsort(order, m, sizeof(*order), compareWidth);
+   for (i = 0; i + 1 < m && 2 * spilled < waiting; ++i){
+      SETSPILLBIT(sub, lo + order[i].x);
+      spilled += count[order[i].x];
+   }
+   free(sum);
+   free(count);
+   free(order);
+   return i > 0;
+}
+
+static FILE *openShardFile(char *name) {
+   static int spillNum = 0;
+   FILE *fp;
+   while (spillNum < DUMPLIMIT){
+      sprintf(name, "%sspill%05d", dumpRoot, ++spillNum);
+      if ((fp = fopen(name, "r")))
+         fclose(fp);
+      else
+         return fopen(name, "wb");
+   }
+   return 0;
+}
+
+/* Mean active width of the waiting nodes, times 16 */
+static int frontierWidth(void) {
+   double width = 0;
+   unsigned long n = 0;
+   node x;
+   for (x = qHead; x < qTail; ++x){
+      if (EMPTY(x)) continue;
+      width += activeWidth(x);
+      ++n;
+   }
+   return n ? (int)(16 * width / n + 0.5) : 0;
+}
+
+/* Spill part of the queue, or all of it if all is set.  Returns 0 if */
+/* nothing could be spilled.                                          */
+static int spillQueue(int all) {
+   node ends[4], lo, hi, cut, x, y, end;
+   node numWords = (node)(QSIZE/64 + 1);
+   uint64_t *sub, *keep;
+   uint32_t *rank;
+   uint32_t count = 0, interior = 0, leaves = 0, r;
+   int d, i, n = 0;
+   spillShard shard;
+   FILE *fp;
+   
+   if (qIsEmpty()) return 0;
+   
+   /* The waiting nodes of each of the (at most two) generations in the queue */
+   /* have nondecreasing ancestors, so the ends of those ranges have the      */
+   /* smallest and largest ancestors in any earlier generation.               */
+   end = nextGeneration();
+   if (end > qTail) end = qTail;
+   for (x = qHead; x < end && EMPTY(x); ++x);
+   if (x < end){
+      ends[n++] = x;
+      for (x = end - 1; EMPTY(x); --x);
+      ends[n++] = x;
+   }
+   for (x = end; x < qTail && EMPTY(x); ++x);
+   if (x < qTail){
+      ends[n++] = x;
+      for (x = qTail - 1; EMPTY(x); --x);
+      ends[n++] = x;
+   }
+   
+   /* find the shallowest generation with more than one ancestor */
+   lo = hi = 0;
+   for (d = 1; !all && d <= headGen; ++d){
+      lo = hi = ancestorAt(ends[0], d);
+      for (i = 1; i < n; ++i){
+         y = ancestorAt(ends[i], d);
+         lo = MIN(lo, y);
+         hi = MAX(hi, y);
+      }
+      if (lo != hi) break;
+   }
+   if (!all && d > headGen) return 0;
+   
+   sub = (uint64_t*)calloc(numWords, sizeof(*sub));
+   keep = (uint64_t*)calloc(numWords, sizeof(*keep));
+   rank = (uint32_t*)malloc(numWords * sizeof(*rank));
+   if (sub == 0 || keep == 0 || rank == 0){
+      free(sub);
+      free(keep);
+      free(rank);
+      return 0;
+   }
+   
+   /* mark the nodes of generation d whose subtrees are spilled, */
+   /* normally those from cut to the end of the generation       */
+   end = (!all && d < genTop) ? genStart[d + 1] : qTail;
+   if (all){
+      for (x = qHead; x < qTail; ++x)
+         if (!EMPTY(x)) SETSPILLBIT(sub, x);
+   }
+   else if (params[P_BESTFIRST] == BEST_WIDTH){
+      if (!widestSubtrees(sub, d, lo, hi)){
+         free(sub);
+         free(keep);
+         free(rank);
+         return 0;
+      }
+   }
+   else {
+      x = qHead + (qTail - qHead) / 2;
+      while (EMPTY(x)) ++x;
+      cut = ancestorAt(x, d);
+      if (cut == lo) cut = hi;
+      for (x = cut; x < end; ++x)
+         if (!EMPTY(x)) SETSPILLBIT(sub, x);
+   }
+   
+   /* mark the rest of their subtrees */
+   for (x = end; x < qTail; ++x)
+      if (!EMPTY(x) && SPILLBIT(sub, PARENT(x)))
+         SETSPILLBIT(sub, x);
+   
+   /* keep the marked nodes still to be processed and all of their ancestors */
+   for (x = qTail - 1; x >= qHead; --x)
+      if (!EMPTY(x) && SPILLBIT(sub, x)) SETSPILLBIT(keep, x);
+   for (x = qTail - 1; x > 0; --x)
+      if (SPILLBIT(keep, x)) SETSPILLBIT(keep, PARENT(x));
+   SETSPILLBIT(keep, 0);
+   
+   for (y = 0; y < numWords; ++y){
+      rank[y] = count;
+      count += __builtin_popcountll(keep[y]);
+   }
+   
+   if (!(fp = openShardFile(shard.file))){
+      free(sub);
+      free(keep);
+      free(rank);
+      return 0;
+   }
+   for (x = 0; x < qHead; ++x)
+      if (SPILLBIT(keep, x)) ++interior;
+   fwrite(&count, sizeof(count), 1, fp);
+   fwrite(&interior, sizeof(interior), 1, fp);
+   for (x = 0; x < qTail; ++x){
+      if (!SPILLBIT(keep, x)) continue;
+      y = PARENT(x);
+      r = rank[y>>6] + __builtin_popcountll(keep[y>>6] & ((1LLU << (y & 63)) - 1));
+      row theRow = ROW(x);
+      fwrite(&r, sizeof(r), 1, fp);
+      fwrite(&theRow, sizeof(theRow), 1, fp);
+   }
+   if (fclose(fp) != 0){
+      fprintf(stderr, "Error: unable to write queue shard %s.\n", shard.file);
+      exit(1);
+   }
+   
+   /* remove the spilled nodes from the queue */
+   shard.depth = 0;
+   double width = 0;
+   for (x = qHead; x < qTail; ++x){
+      if (EMPTY(x) || !SPILLBIT(keep, x)) continue;
+      if (!shard.depth) shard.depth = nodeDepth(x);
+      width += activeWidth(x);
+      uint32_t deepIndex = deepRowIndices[deepQHead + x - qHead];
+      if (deepIndex > 1) freeDeepIndex(deepIndex);
+      deepRowIndices[deepQHead + x - qHead] = 0;
+      MAKEEMPTY(x);
+      ++leaves;
+   }
+   shard.nodes = leaves;
+   shard.width = (int)(16 * width / leaves + 0.5);
+   free(sub);
+   free(keep);
+   free(rank);
+   
+   if (numShards == shardCap){
+      shardCap = shardCap ? 2 * shardCap : 16;
+      shards = (spillShard*)realloc(shards, shardCap * sizeof(*shards));
+      if (shards == 0){
+         fprintf(stderr, "Error: unable to allocate memory for queue shard list.\n");
+         exit(1);
+      }
+   }
+   shards[numShards++] = shard;
+   
+   timeStamp();
+   printf("Spilled ");
+   putnum(leaves);
+   printf(" nodes at depth %d to %s, ", shard.depth, shard.file);
+   
+   /* Compaction hands the packed extension indices to the waiting nodes in */
+   /* order, so between deepening steps the nodes without one are given 1,  */
+   /* which stands for an extension with no saved rows.                     */
+   for (x = qHead; x < qTail; ++x)
+      if (!EMPTY(x) && deepRowIndices[deepQHead + x - qHead] == 0)
+         deepRowIndices[deepQHead + x - qHead] = 1;
+   doCompact();
+   putnum(qTail - qHead);
+   printf("/");
+   putnum(qTail);
+   printf(" left\n");
+   return 1;
+}
+
+/* Should shard a be restored before shard b? */
+static int shardBefore(const spillShard *a, const spillShard *b) {
+   if (params[P_BESTFIRST] == BEST_WIDTH && a->width != b->width)
+      return a->width < b->width;
+   if (params[P_BESTFIRST] != BEST_OFF)
+      return a->depth > b->depth;
+   return a->depth < b->depth;
+}
+
+/* Load the next shard into the empty queue: the one with the shallowest */
+/* nodes, or the best one with --best-first.  Returns 0 if there are no  */
+/* shards left.                                                          */
+static int restoreShard(void) {
+   uint32_t count, interior, r, i;
+   node *local;
+   row theRow;
+   FILE *fp;
+   int k, best = 0;
+   
+   if (numShards == 0) return 0;
+   for (k = 1; k < numShards; ++k)
+      if (shardBefore(&shards[k], &shards[best])) best = k;
+   spillShard shard = shards[best];
+   shards[best] = shards[--numShards];
+   
+   if (!(fp = fopen(shard.file, "rb"))
+       || fread(&count, sizeof(count), 1, fp) != 1
+       || fread(&interior, sizeof(interior), 1, fp) != 1
+       || count > QSIZE - QSIZE/16 || interior >= count){
+      fprintf(stderr, "Error: unable to read queue shard %s.\n", shard.file);
+      exit(1);
+   }
+   local = (node*)malloc(count * sizeof(*local));
+   if (local == 0){
+      fprintf(stderr, "Error: unable to allocate memory for queue shard %s.\n", shard.file);
+      exit(1);
+   }
+   
+   resetQ();
+   resetHash();
+   for (i = 0; i < count; ++i){
+      if (fread(&r, sizeof(r), 1, fp) != 1 || fread(&theRow, sizeof(theRow), 1, fp) != 1 || r > i){
+         fprintf(stderr, "Error: unable to read queue shard %s.\n", shard.file);
+         exit(1);
+      }
+      enqueue(i ? local[r] : 0, theRow);
+      local[i] = qTail - 1;
+      setVisited(qTail - 1);
+   }
+   fclose(fp);
+   if (params[P_DUMPMODE] == D_DISABLED)
+      remove(shard.file);     /* otherwise earlier dumps may still need it */
+   
+   qHead = local[interior];
+   deepQHead = qHead;
+   for (i = deepQHead; i < deepQTail && i < QSIZE; ++i)
+      deepRowIndices[i] = 0;
+   free(local);
+   rephase();
+   
+   timeStamp();
+   printf("Restored ");
+   putnum(qTail - qHead);
+   printf(" nodes at depth %d from %s\n", shard.depth, shard.file);
+   return 1;
+}
+
+static inline int queueFull(void) {
+   return qTail - qHead >= (1LLU<<params[P_DEPTHLIMIT]) || qTail >= QSIZE - QSIZE/16;
+}
+
+/* With spilling, the queue is spilled before it is within QSIZE/8 of the   */
+/* end, or too near it to hold every child of one node, so that neither the */
+/* forced deepening at QSIZE - QSIZE/16 nor qFull() is reached.             */
+static inline int spillDue(void) {
+   return (params[P_SPILL] || params[P_BESTFIRST])
+          && qTail + MAX(QSIZE/8, (1LLU << width) + BASEFACTOR) >= QSIZE;
+}
+
+/* ============================================ */
+/*  Iterative-deepening depth-first search      */
+/* ============================================ */
+
+/* With --enable-iddfs, the breadth-first search only runs until the queue
+** holds at least 64 nodes per thread, all deeper than 2*period.  Those
+** nodes, from at most two generations, are the roots of independent
+** subtrees, and each pass searches every path of up to a bound number of
+** rows below each root, with the roots shared out between threads.  The
+** bound starts at -n (or the deepening increment) and grows by the
+** increment after each pass.  A pass prints the spaceships longer than the
+** previous bound, since the shorter ones were printed before, and drops the
+** roots with no path as long as the bound.
+**
+** Like the hash table of the breadth-first search, a path is cut at a state
+** (its last 2*period rows) seen before: on the same path, in the queue, or
+** at a smaller depth in a table of SEENSIZE states kept by each thread from
+** pass to pass.  Without this, periodic tails let the bound grow forever
+** and longer copies of the same spaceships are printed.  Memory use is the
+** queue of roots and the tables, plus a few rows per level of the bound for
+** each thread.
+**
+** Dumps record the bound in lastDeep.  A root finished in the current pass
+** is flagged with extension index 1, and a search in progress is stopped at
+** a new level and saved as the root's extension, to be resumed the same way
+** as after an early exit from deepening.
+*/
+
+/* Is it time to stop the searches and dump the state? */
+int iddfsDumpDue(void) {
+   return params[P_DUMPMODE] != D_DISABLED && time(NULL) - lastDumpTime >= params[P_DUMPINTERVAL];
+}
+
+static void iterativeDeepening(void) {
+   long long target = 64LL * params[P_NUMTHREADS];
+   int bound, prevBound;
+   long long roots;
+   _Atomic int pause;
+   int announce = 1;
+   uint32_t passes = 0;
+   node x;
+   iddfsTables *tables;
+   
+   /* a dump made by this search already holds the roots */
+   int resumed = lastDeep > 0 && !qIsEmpty();
+   while (!resumed && !aborting && !qIsEmpty() && (qTail - qHead < target || nodeDepth(qHead) <= 2 * period)){
+      if (queueFull()){
+         timeStamp();
+         printf("Queue full, depth ");
+         deepen();
+      }
+      else
+         process(dequeue());
+   }
+   if (aborting || qIsEmpty()) return;
+   
+   /* Extensions from deepen() don't mark searched rows, so drop them.  This */
+   /* must come before compaction, which assumes that every node from qHead */
+   /* has an index, as it does just after deepening.                        */
+   if (!resumed){
+      for (x = qHead; x < qTail; ++x){
+         uint32_t *d = &deepRowIndices[deepQHead + x - qHead];
+         if (*d > 1) freeDeepIndex(*d);
+         *d = 0;
+      }
+   }
+   doCompact();
+   
+   tables = (iddfsTables*)calloc(params[P_NUMTHREADS], sizeof(*tables));
+   if (tables == 0){
+      fprintf(stderr, "Error: unable to allocate memory for repeated state tables.\n");
+      exit(1);
+   }
+   for (int k = 0; k < params[P_NUMTHREADS]; ++k){
+      tables[k].rows = (row*)malloc(SEENSIZE * 2 * params[P_PERIOD] * sizeof(row));
+      tables[k].depth = (uint32_t*)calloc(SEENSIZE, sizeof(uint32_t));
+      tables[k].pass = (uint32_t*)calloc(SEENSIZE, sizeof(uint32_t));
+      if (tables[k].rows == 0 || tables[k].depth == 0 || tables[k].pass == 0){
+         fprintf(stderr, "Error: unable to allocate memory for repeated state tables.\n");
+         exit(1);
+      }
+   }
+   trackMemory(MEM_HASH, params[P_NUMTHREADS] * (long long)SEENSIZE * (2 * params[P_PERIOD] * sizeof(row) + 2 * sizeof(uint32_t)));
+   
+   if (params[P_FIRSTDEEP]){     /* cleared once the first pass is complete */
+      bound = params[P_FIRSTDEEP];
+      prevBound = 0;
+   }
+   else if (resumed){
+      bound = lastDeep;
+      prevBound = MAX(bound - MINDEEP, 0);
+   }
+   else {
+      bound = MINDEEP;
+      prevBound = 0;
+   }
+   
+   while (!aborting){
+      lastDeep = bound;
+      if (announce){
+         roots = liveLeaves();
+         timeStamp();
+         printf("Iterative deepening to depth %d, ", nodeDepth(qHead) + bound);
+         putnum(roots);
+         printf(" subtrees\n");
+         fflush(stdout);
+         announce = 0;
+      }
+      
+      atomic_store_explicit(&pause, 0, memory_order_relaxed);
+      ++passes;      /* a pass resumed after a dump counts as a new one */
+      #pragma omp parallel
+      {
+         uint16_t **pInd = (uint16_t**)calloc(bound + 4 * params[P_PERIOD], sizeof(*pInd));
+         int *pRemain = (int*)calloc(bound + 4 * params[P_PERIOD], sizeof(*pRemain));
+         row *pRows = (row*)calloc(bound + 4 * params[P_PERIOD], sizeof(*pRows));
+         iddfsTables *t = &tables[omp_get_thread_num()];
+         t->pathHead = (uint32_t*)calloc(PATHHASHSIZE, sizeof(*t->pathHead));
+         t->pathNext = (uint32_t*)calloc(bound + 4 * params[P_PERIOD], sizeof(*t->pathNext));
+         t->thisPass = passes;
+         branchReserve(bound + 4 * params[P_PERIOD]);
+         long long j;
+         int searched = 0;    /* search a root before pausing, so each dump makes progress */
+         
+         #pragma omp for schedule(dynamic, 1)
+         for (j = qHead; j < qTail; ++j){
+            if (EMPTY(j) || deepRowIndices[deepQHead + j - qHead] == 1) continue;
+            if (searched && iddfsDumpDue()) atomic_store_explicit(&pause, 1, memory_order_relaxed);
+            if (aborting || atomic_load_explicit(&pause, memory_order_relaxed)) continue;
+            int r = iddfsNode((node)j, bound, prevBound, pInd, pRemain, pRows, t, &pause);
+            ++searched;
+            if (r == 0)
+               MAKEEMPTY(j);
+            else if (r == 1)
+               deepRowIndices[deepQHead + j - qHead] = 1;
+         }
+         free(pInd);
+         free(pRemain);
+         free(pRows);
+         free(t->pathHead);
+         free(t->pathNext);
+      }
+      
+      if (atomic_load_explicit(&pause, memory_order_relaxed) && !aborting){
+         /* Compaction and dumps keep only the number of searched roots, so */
+         /* search again any root after the first one left unsearched.      */
+         for (x = qHead; x < qTail && (EMPTY(x) || deepRowIndices[deepQHead + x - qHead]); ++x);
+         for (; x < qTail; ++x)
+            deepRowIndices[deepQHead + x - qHead] = 0;
+         dumpFlag = DUMPPENDING;
+         time(&lastDumpTime);
+         doCompact();
+         reportDump();
+         fflush(stdout);
+         continue;
+      }
+      if (aborting) break;
+      
+      /* the pass is complete: drop the dead roots and raise the bound */
+      for (x = qHead; x < qTail; ++x)
+         deepRowIndices[deepQHead + x - qHead] = 0;
+      doCompact();
+      if (qIsEmpty()) break;
+      longest = MAX(longest, nodeDepth(qHead) + bound);
+      params[P_FIRSTDEEP] = 0;
+      prevBound = bound;
+      bound += MINDEEP;
+      announce = 1;
+   }
+   
+   for (int k = 0; k < params[P_NUMTHREADS]; ++k){
+      free(tables[k].rows);
+      free(tables[k].depth);
+      free(tables[k].pass);
+   }
+   free(tables);
+   trackMemory(MEM_HASH, -params[P_NUMTHREADS] * (long long)SEENSIZE * (2 * params[P_PERIOD] * sizeof(row) + 2 * sizeof(uint32_t)));
+}
+
+/* ======================================== */
+/*  External-memory breadth-first search    */
+/* ======================================== */
+
+/* With --external-bfs, each generation is kept in a file <dump root>genNNNNN
+** of records, each holding the last 2*period+1 rows of a node followed by the
+** position of its parent in the previous generation's file.  Every node is
+** first checked with a depth-first search of MINDEEP rows, and the children of
+** the nodes that pass are collected by each thread in sorted runs of limited
+** size.  The runs are merged into the next generation's file, keeping one node
+** out of each group whose last 2*period rows match exactly, as the hash table
+** of the queue does.  Like the hash table, this holds across generations: the
+** rows of every node so far are kept in sorted runs <dump root>seenNNNNN, and
+** the merge drops the nodes found in them and writes the rows of the others
+** to a new run.  Runs of similar size are merged, so there are only a few,
+** and each has every EXTSEENSTEP-th row in memory, so the merge only reads the
+** blocks of a run which may hold one of its nodes.  Without that periodic
+** tails and spaceships trailing other spaceships would be searched forever.
+** Duplicates are found however large the search gets, and apart from those
+** blocks all file access is sequential.  The queue in memory holds the search
+** up to the first generation on disk, whose parent positions are queue nodes;
+** it is left alone so spaceships can be traced back through it.
+*/
+
+#define EXTBATCH (1 << 16)    /* records read from a generation at a time */
+#define EXTMERGEWAY 256       /* most runs merged at once */
+#define EXTSEENSTEP 1024      /* rows in each block of a seen run */
+
+int extRowsSize;     /* bytes of rows in a record */
+int extKeySize;      /* bytes of the last 2*period rows, which are compared */
+int extRecSize;
+_Atomic int extNumRuns;
+
+typedef struct {
+   unsigned char *data;
+   size_t n;            /* number of records */
+   size_t cap;
+} extBuffer;
+
+typedef struct {
+   int id;                 /* the run is in <dump root>seenNNNNN */
+   uint64_t n;             /* rows in the run */
+   unsigned char *index;   /* the first row of each block */
+   size_t indexCap;
+   FILE *fp;               /* open while a merge checks against the run */
+   unsigned char *block;   /* the block last read */
+   uint64_t blockNum;      /* which block that is, or UINT64_MAX */
+} extSeenRun;
+
+extSeenRun *seenRuns = 0;  /* oldest first */
+int numSeenRuns = 0, seenRunCap = 0, nextSeenId = 0;
+
+static void extFileName(char *name, const char *kind, int num) {
+   sprintf(name, "%s%s%05d", dumpRoot, kind, num);
+}
+
+static uint32_t extParent(const unsigned char *rec) {
+   uint32_t p;
+   memcpy(&p, rec + extRowsSize, sizeof(p));
+   return p;
+}
+
+/* compare the last 2*period rows of two records */
+static inline int extKeyCompare(const unsigned char *a, const unsigned char *b) {
+   return memcmp(a + sizeof(row), b + sizeof(row), extKeySize);
+}
+
+static int extCompare(const void *a, const void *b) {
+   int c = extKeyCompare((const unsigned char*)a, (const unsigned char*)b);
+   if (c) return c;
+   uint32_t pa = extParent((const unsigned char*)a), pb = extParent((const unsigned char*)b);
+   return (pa > pb) - (pa < pb);
+}
+
+static void extWrite(FILE *fp, const void *data, size_t size, size_t n, const char *name) {
+   if (fwrite(data, size, n, fp) != n){
+      fprintf(stderr, "Error: unable to write %s.\n", name);
+      exit(1);
+   }
+}
+
+/* Sort the records of b and write them out as a new run */
+static void extFlush(extBuffer *b) {
+   char name[300];
+   FILE *fp;
+   if (b->n == 0) return;
+   qsort(b->data, b->n, extRecSize, extCompare);
+   extFileName(name, "run", atomic_fetch_add_explicit(&extNumRuns, 1, memory_order_relaxed));
+   if (!(fp = fopen(name, "wb"))){
+      fprintf(stderr, "Error: unable to create %s.\n", name);
+      exit(1);
+   }
+   extWrite(fp, b->data, extRecSize, b->n, name);
+   fclose(fp);
+   b->n = 0;
+}
+
+/* Start a new seen run at the end of seenRuns, open for writing in *fp */
+static void extNewSeenRun(FILE **fp, char *name) {
+   if (numSeenRuns == seenRunCap){
+      seenRunCap = seenRunCap ? 2 * seenRunCap : 16;
+      seenRuns = (extSeenRun*)realloc(seenRuns, seenRunCap * sizeof(*seenRuns));
+      if (seenRuns == 0){
+         fprintf(stderr, "Error: unable to allocate memory for external-memory search.\n");
+         exit(1);
+      }
+   }
+   extSeenRun *r = &seenRuns[numSeenRuns++];
+   memset(r, 0, sizeof(*r));
+   r->id = nextSeenId++;
+   extFileName(name, "seen", r->id);
+   if (!(*fp = fopen(name, "wb"))){
+      fprintf(stderr, "Error: unable to create %s.\n", name);
+      exit(1);
+   }
+}
+
+/* Add a row to the end of run r, indexing the first of each block */
+static void extSeenAppend(extSeenRun *r, FILE *fp, const unsigned char *key, const char *name) {
+   if (r->n % EXTSEENSTEP == 0){
+      size_t b = r->n / EXTSEENSTEP;
+      if (b == r->indexCap){
+         r->indexCap = r->indexCap ? 2 * r->indexCap : 64;
+         r->index = (unsigned char*)realloc(r->index, r->indexCap * extKeySize);
+         if (r->index == 0){
+            fprintf(stderr, "Error: unable to allocate memory for external-memory search.\n");
+            exit(1);
+         }
+         trackMemory(MEM_OTHER, (long long)(r->indexCap / 2) * extKeySize);
+      }
+      memcpy(r->index + b * extKeySize, key, extKeySize);
+   }
+   extWrite(fp, key, extKeySize, 1, name);
+   ++r->n;
+}
+
+static void extDropSeenRun(extSeenRun *r) {
+   char name[300];
+   extFileName(name, "seen", r->id);
+   remove(name);
+   free(r->index);
+   trackMemory(MEM_OTHER, -(long long)r->indexCap * extKeySize);
+}
+
+/* Open the first count seen runs for extSeenFind() (open != 0) or close them */
+static void extOpenSeenRuns(int count, int open) {
+   char name[300];
+   int k;
+   for (k = 0; k < count; ++k){
+      extSeenRun *r = &seenRuns[k];
+      if (!open){
+         fclose(r->fp);
+         free(r->block);
+         continue;
+      }
+      extFileName(name, "seen", r->id);
+      r->fp = fopen(name, "rb");
+      r->block = (unsigned char*)malloc((size_t)EXTSEENSTEP * extKeySize);
+      r->blockNum = UINT64_MAX;
+      if (!r->fp || !r->block){
+         fprintf(stderr, "Error: unable to open %s.\n", name);
+         exit(1);
+      }
+   }
+}
+
+/* Is key in run r?  The index gives the only block that may hold it. */
+static int extSeenFind(extSeenRun *r, const unsigned char *key) {
+   uint64_t lo = 0, hi = (r->n + EXTSEENSTEP - 1) / EXTSEENSTEP, len;
+   char name[300];
+   
+   if (hi == 0 || memcmp(r->index, key, extKeySize) > 0) return 0;
+   while (hi - lo > 1){
+      uint64_t mid = (lo + hi) / 2;
+      if (memcmp(r->index + mid * extKeySize, key, extKeySize) <= 0) lo = mid;
+      else hi = mid;
+   }
+   len = MIN(r->n - lo * EXTSEENSTEP, (uint64_t)EXTSEENSTEP);
+   if (r->blockNum != lo){
+      if (fseek(r->fp, (long)(lo * EXTSEENSTEP * extKeySize), SEEK_SET) != 0
+          || fread(r->block, extKeySize, len, r->fp) != len){
+         extFileName(name, "seen", r->id);
+         fprintf(stderr, "Error: unable to read %s.\n", name);
+         exit(1);
+      }
+      r->blockNum = lo;
+   }
+   for (lo = 0, hi = len; lo < hi; ){
+      uint64_t mid = (lo + hi) / 2;
+      int c = memcmp(r->block + mid * extKeySize, key, extKeySize);
+      if (c == 0) return 1;
+      if (c < 0) lo = mid + 1;
+      else hi = mid;
+   }
+   return 0;
+}
+
+/* Merge the last two seen runs while the older is less than twice the */
+/* size of the newer, so each row is rewritten only a few times.       */
+static void extMergeSeenRuns(void) {
+   char name[300], inName[300];
+   unsigned char *key = (unsigned char*)malloc(2 * extKeySize);
+   FILE *in[2], *out;
+   int have[2], i, k;
+   
+   if (key == 0){
+      fprintf(stderr, "Error: unable to allocate memory for external-memory search.\n");
+      exit(1);
+   }
+   while (numSeenRuns >= 2 && seenRuns[numSeenRuns - 2].n < 2 * seenRuns[numSeenRuns - 1].n){
+      k = numSeenRuns - 2;
+      extNewSeenRun(&out, name);
+      for (i = 0; i < 2; ++i){
+         extFileName(inName, "seen", seenRuns[k + i].id);
+         if (!(in[i] = fopen(inName, "rb"))){
+            fprintf(stderr, "Error: unable to open %s.\n", inName);
+            exit(1);
+         }
+         have[i] = fread(key + i * extKeySize, extKeySize, 1, in[i]) == 1;
+      }
+      /* the runs never share a row */
+      while (have[0] || have[1]){
+         i = !have[0] || (have[1] && memcmp(key + extKeySize, key, extKeySize) < 0);
+         extSeenAppend(&seenRuns[k + 2], out, key + i * extKeySize, name);
+         have[i] = fread(key + i * extKeySize, extKeySize, 1, in[i]) == 1;
+      }
+      if (fclose(out) != 0){
+         fprintf(stderr, "Error: unable to write %s.\n", name);
+         exit(1);
+      }
+      for (i = 0; i < 2; ++i){
+         fclose(in[i]);
+         extDropSeenRun(&seenRuns[k + i]);
+      }
+      seenRuns[k] = seenRuns[k + 2];
+      numSeenRuns = k + 1;
+   }
+   free(key);
+}
+
+/* Merge runs first to first + count - 1 into the file outName, keeping  */
+/* the first of each group of records with the same rows.  If seen is    */
+/* set, records whose rows are in a seen run are dropped too, and the    */
+/* rows of the records kept become a new seen run.  outName may be 0 if  */
+/* only the seen run is wanted.  Returns the number of records kept.     */
+static uint32_t extMerge(int first, int count, const char *outName, int seen) {
+   FILE **in = (FILE**)calloc(count, sizeof(*in));
+   unsigned char *cur = (unsigned char*)malloc((size_t)count * extRecSize);
+   unsigned char *last = (unsigned char*)malloc(extRecSize);
+   int *heap = (int*)malloc(count * sizeof(*heap));
+   char name[300], seenName[300];
+   int i, j, k, n = 0, haveLast = 0, old = numSeenRuns;
+   uint32_t written = 0;
+   FILE *out = 0, *seenOut = 0;
+   
+   if (!in || !cur || !last || !heap || (outName && !(out = fopen(outName, "wb")))){
+      fprintf(stderr, "Error: unable to merge runs into %s.\n", outName ? outName : "a seen run");
+      exit(1);
+   }
+   if (seen){
+      extNewSeenRun(&seenOut, seenName);
+      extOpenSeenRuns(old, 1);
+   }
+   
+   /* heap of the runs which still have records, ordered by current record */
+   #define EXTLESS(a,b) (extCompare(cur + (size_t)(a) * extRecSize, cur + (size_t)(b) * extRecSize) < 0)
+   for (i = 0; i < count; ++i){
+      extFileName(name, "run", first + i);
+      if (!(in[i] = fopen(name, "rb"))){
+         fprintf(stderr, "Error: unable to open %s.\n", name);
+         exit(1);
+      }
+      if (fread(cur + (size_t)i * extRecSize, extRecSize, 1, in[i]) != 1) continue;
+      for (j = n++; j > 0 && EXTLESS(i, heap[(j - 1) / 2]); j = (j - 1) / 2)
+         heap[j] = heap[(j - 1) / 2];
+      heap[j] = i;
+   }
+   
+   while (n > 0){
+      i = heap[0];
+      unsigned char *rec = cur + (size_t)i * extRecSize;
+      if (!haveLast || extKeyCompare(rec, last) != 0){
+         memcpy(last, rec, extRecSize);
+         haveLast = 1;
+         for (k = 0; seen && k < old && !extSeenFind(&seenRuns[k], rec + sizeof(row)); ++k);
+         if (!seen || k == old){
+            if (out) extWrite(out, rec, extRecSize, 1, outName);
+            if (seen) extSeenAppend(&seenRuns[old], seenOut, rec + sizeof(row), seenName);
+            ++written;
+         }
+      }
+      
+      /* replace the top of the heap by the next record of its run */
+      int top = i;
+      if (fread(rec, extRecSize, 1, in[i]) != 1) top = heap[--n];
+      for (j = 0; 2 * j + 1 < n; ){
+         int k = 2 * j + 1;
+         if (k + 1 < n && EXTLESS(heap[k + 1], heap[k])) ++k;
+         if (!EXTLESS(heap[k], top)) break;
+         heap[j] = heap[k];
+         j = k;
+      }
+      if (n > 0) heap[j] = top;
+   }
+   #undef EXTLESS
+   
+   for (i = 0; i < count; ++i){
+      fclose(in[i]);
+      extFileName(name, "run", first + i);
+      remove(name);
+   }
+   if (out && fclose(out) != 0){
+      fprintf(stderr, "Error: unable to write %s.\n", outName);
+      exit(1);
+   }
+   if (seenOut && fclose(seenOut) != 0){
+      fprintf(stderr, "Error: unable to write %s.\n", seenName);
+      exit(1);
+   }
+   if (seen){
+      extOpenSeenRuns(old, 0);
+      if (seenRuns[old].n == 0){
+         extDropSeenRun(&seenRuns[old]);
+         --numSeenRuns;
+      }
+      extMergeSeenRuns();
+   }
+   free(in);
+   free(cur);
+   free(last);
+   free(heap);
+   return written;
+}
+
+/* Does the node whose last 2*period rows are w end a spaceship? */
+static int extTerminal(const row *w) {
+   int p;
+   for (p = 0; p < period; p++)
+      if (w[2 * period - 1 - p] != 0) return 0;
+   for (p = 0; p < period; p++)
+      if (causesBirth[w[period - 1 - p]]) return 0;
+   return 1;
+}
+
+/* Sort what is left in the buffers of the threads and merge all the runs.
+** The records kept are written to the file of generation gen, or for gen
+** -1, the nodes of the queue before the first generation, only added to
+** the rows seen.  Returns the number of records kept.
+*/
+static uint32_t extMergeGeneration(extBuffer *bufs, int gen) {
+   char name[300];
+   int t, runs, next = 0;
+   uint32_t count;
+   
+   #pragma omp parallel for schedule(dynamic, 1)
+   for (t = 0; t < params[P_NUMTHREADS]; ++t)
+      extFlush(&bufs[t]);
+   runs = atomic_load_explicit(&extNumRuns, memory_order_relaxed);
+   while (runs - next > EXTMERGEWAY){
+      extFileName(name, "run", runs);
+      extMerge(next, EXTMERGEWAY, name, 0);
+      next += EXTMERGEWAY;
+      ++runs;
+   }
+   extFileName(name, "gen", gen);
+   count = extMerge(next, runs - next, gen >= 0 ? name : 0, 1);
+   return count;
+}
+
+/* Trace record i of generation gen back to the queue.  Returns the rows */
+/* of the node, with room for one more, in the form used by success():   */
+/* the queue node is *b and its row is at position 2*period.             */
+static row *extTrace(int gen, uint32_t i, node *b) {
+   char name[300];
+   unsigned char *rec = (unsigned char*)malloc(extRecSize);
+   row *pRows = (row*)calloc(2 * period + gen + 2, sizeof(*pRows));
+   row w;
+   node x;
+   int g, j;
+   FILE *fp;
+   
+   if (!rec || !pRows){
+      fprintf(stderr, "Error: unable to allocate memory to print a pattern.\n");
+      exit(1);
+   }
+   for (g = gen; g >= 0; --g){
+      extFileName(name, "gen", g);
+      if (!(fp = fopen(name, "rb")) || fseek(fp, (long)i * extRecSize, SEEK_SET) != 0
+          || fread(rec, extRecSize, 1, fp) != 1){
+         fprintf(stderr, "Error: unable to read %s.\n", name);
+         exit(1);
+      }
+      fclose(fp);
+      memcpy(&w, rec + extRowsSize - sizeof(row), sizeof(row));
+      pRows[2 * period + g] = w;
+      i = extParent(rec);
+   }
+   
+   /* the parent of a record in generation 0 is a queue node */
+   *b = x = (node)i;
+   for (j = 2 * period; j >= 0; --j){
+      pRows[j] = ROW(x);
+      x = PARENT(x);
+   }
+   free(rec);
+   return pRows;
+}
+
+/* Print the spaceship which ends with row r added to record i of */
+/* generation gen.  Returns 1 if it was skipped as a known one.    */
+static int extSuccess(int gen, uint32_t i, row r) {
+   node b;
+   int known;
+   row *pRows = extTrace(gen, i, &b);
+   pRows[2 * period + gen + 1] = r;
+   known = success(b, pRows, 2 * period, 2 * period + gen + 1);
+   free(pRows);
+   return known;
+}
+
+int extExpand(const unsigned char *rec, uint32_t i, int gen, int depth,
+              uint16_t **pInd, int *pRemain, row *pRows, extBuffer *out);
+
+static void externalBreadthFirst(void) {
+   char name[300], inName[300];
+   int numThreads = params[P_NUMTHREADS];
+   size_t perThread;
+   unsigned char *batch;
+   extBuffer *bufs;
+   uint32_t count = 0;
+   int gen, depth, t, runs;
+   long long children;
+   node x;
+   FILE *fp;
+   
+   extKeySize = 2 * period * sizeof(row);
+   extRowsSize = extKeySize + sizeof(row);
+   extRecSize = extRowsSize + sizeof(uint32_t);
+   
+   /* finish the generation at qHead in memory, so that the queue holds one */
+   /* generation, and go deep enough that every record has 2*period rows    */
+   /* of queue nodes behind it for printing patterns                        */
+   while (!aborting && !qIsEmpty() && (qHead != nextGeneration() || nodeDepth(qHead) <= 2 * period))
+      process(dequeue());
+   if (aborting || qIsEmpty()) return;
+   
+   perThread = MAX(((size_t)params[P_EXTBFS] << 20) / numThreads / extRecSize, (size_t)1024);
+   batch = (unsigned char*)malloc((size_t)EXTBATCH * extRecSize);
+   bufs = (extBuffer*)calloc(numThreads, sizeof(*bufs));
+   if (!batch || !bufs){
+      fprintf(stderr, "Error: unable to allocate memory for external-memory search.\n");
+      exit(1);
+   }
+   for (t = 0; t < numThreads; ++t){
+      bufs[t].cap = perThread;
+      bufs[t].data = (unsigned char*)malloc(perThread * extRecSize);
+      if (!bufs[t].data){
+         fprintf(stderr, "Error: unable to allocate memory for external-memory search.\n");
+         exit(1);
+      }
+   }
+   trackMemory(MEM_OTHER, ((size_t)EXTBATCH + perThread * numThreads) * extRecSize);
+   
+   /* The rows of the nodes before qHead are the first rows seen.       */
+   /* Generation 0 is the rest of the queue; its parent positions are  */
+   /* queue nodes.  It goes through the runs as well, so it is sorted. */
+   depth = genTop;
+   for (gen = -1; gen <= 0; ++gen){
+      atomic_store_explicit(&extNumRuns, 0, memory_order_relaxed);
+      for (x = gen ? 0 : qHead; x < (gen ? qHead : qTail); ++x){
+         node y = x;
+         row w[2 * MAXPERIOD + 1];
+         if (EMPTY(x)) continue;
+         for (t = 2 * period; t >= 0; --t){
+            w[t] = ROW(y);
+            y = PARENT(y);
+         }
+         if (bufs[0].n == bufs[0].cap) extFlush(&bufs[0]);
+         unsigned char *rec = bufs[0].data + bufs[0].n++ * extRecSize;
+         memcpy(rec, w, extRowsSize);
+         memcpy(rec + extRowsSize, &x, sizeof(x));
+      }
+      count = extMergeGeneration(bufs, gen);
+   }
+   timeStamp();
+   printf("External-memory search from depth %d, ", depth);
+   putnum(count);
+   printf(" nodes\n");
    fflush(stdout);
    
-   _Atomic int remainingItems = 0;
-   _Atomic int forceExit = 0;
-   _Atomic int passed = 0;
-   atomic_store_explicit(&remainingItems, qTail - qHead, memory_order_seq_cst);
-   atomic_store_explicit(&forceExit, 0, memory_order_seq_cst);
-   atomic_store_explicit(&passed, 0, memory_order_seq_cst);
-
-   /* go through queue, deepening each one */
-   #pragma omp parallel
-   {
-      uint16_t **pInd;
-      int *pRemain;
-      row *pRows;
+   for (gen = 0; count > 0 && !aborting; ++gen, ++depth){
+      if (evictPending) evictTable();
+      extFileName(inName, "gen", gen);
+      if (!(fp = fopen(inName, "rb"))){
+         fprintf(stderr, "Error: unable to open %s.\n", inName);
+         exit(1);
+      }
+      atomic_store_explicit(&extNumRuns, 0, memory_order_relaxed);
+      children = 0;
       
-      pInd = (uint16_t**)calloc((deepeningAmount + 4 * params[P_PERIOD]), sizeof(*pInd));
-      pRemain = (int*)calloc((deepeningAmount + 4 * params[P_PERIOD]), sizeof(*pRemain));
-      pRows = (row*)calloc((deepeningAmount + 4 * params[P_PERIOD]), sizeof(*pRows));
+      uint32_t first = 0;
+      size_t n;
+      while (!aborting && (n = fread(batch, extRecSize, EXTBATCH, fp)) > 0){
+         #pragma omp parallel
+         {
+            extBuffer *out = &bufs[omp_get_thread_num()];
+            uint16_t **pInd = (uint16_t**)calloc(MINDEEP + 4 * params[P_PERIOD], sizeof(*pInd));
+            int *pRemain = (int*)calloc(MINDEEP + 4 * params[P_PERIOD], sizeof(*pRemain));
+            row *pRows = (row*)calloc(MINDEEP + 4 * params[P_PERIOD], sizeof(*pRows));
+            branchReserve(MINDEEP + 4 * params[P_PERIOD]);
+            long long j;
+            
+            #pragma omp for schedule(dynamic, CHUNK_SIZE) reduction(+:children)
+            for (j = 0; j < (long long)n; ++j)
+               children += extExpand(batch + j * extRecSize, first + (uint32_t)j, gen, depth,
+                                     pInd, pRemain, pRows, out);
+            free(pInd);
+            free(pRemain);
+            free(pRows);
+         }
+         first += (uint32_t)n;
+      }
+      fclose(fp);
+      if (aborting) break;
       
-      long long j;
-      #pragma omp for schedule(dynamic, CHUNK_SIZE)
-      for (j = qHead; j < qTail; j++) {
-         if (!EMPTY(j) && !depthFirst((node)j, (uint16_t)deepeningAmount, pInd, pRemain, pRows, &remainingItems, &forceExit, &passed))
-            MAKEEMPTY(j);
-         atomic_fetch_sub_explicit(&remainingItems, 1, memory_order_relaxed);
+      count = extMergeGeneration(bufs, gen + 1);
+      runs = atomic_load_explicit(&extNumRuns, memory_order_relaxed);
+      
+      if (count > 0){
+         longest = depth + 1;
+         if (params[P_LONGEST]){
+            /* keep the first node of the new generation as the longest partial result */
+            node b;
+            row *pRows = extTrace(gen + 1, 0, &b);
+            bufferPattern(b, pRows, 2 * period, 2 * period + gen + 1, 0);
+            free(pRows);
+         }
       }
-      free(pInd);
-      free(pRemain);
-      free(pRows);
+      
+      timeStamp();
+      printf("Depth %d, ", depth + 1);
+      putnum(children);
+      printf(" -> ");
+      putnum(count);
+      printf(" nodes, %d run%s\n", runs, runs == 1 ? "" : "s");
+      fflush(stdout);
    }
    
-   /* before reporting new queue size, shrink tree back down */
-   printf(" -> ");
-   fflush(stdout);
+   for (t = 0; t < numThreads; ++t)
+      free(bufs[t].data);
+   free(bufs);
+   free(batch);
+   trackMemory(MEM_OTHER, -(long long)(((size_t)EXTBATCH + perThread * numThreads) * extRecSize));
    
-   /* signal time for dump */
-   if (params[P_DUMPMODE] != D_DISABLED && time(NULL) - lastDumpTime >= params[P_DUMPINTERVAL]){
-      dumpFlag = DUMPPENDING;
-      time(&lastDumpTime);
+   /* the generation files are only needed to trace spaceships back */
+   for (t = 0; t <= gen + 1; ++t){
+      extFileName(name, "gen", t);
+      remove(name);
    }
+   while (numSeenRuns > 0)
+      extDropSeenRun(&seenRuns[--numSeenRuns]);
+}
+
+/* With --best-first, is a generation starting, with shards to compare? */
+node switchChecked = 0;    /* the generation start last compared */
+static inline int switchDue(void) {
+   return params[P_BESTFIRST] && numShards && qHead == nextGeneration() && qHead != switchChecked;
+}
+
+/* At the start of each generation, compare the nodes waiting in memory    */
+/* with the best shard.  If the shard ranks higher, by more than a column  */
+/* of active width so that the search does not switch back and forth, the  */
+/* whole queue is spilled and that shard restored.  Returns 1 if so.       */
+static int switchFrontier(void) {
+   spillShard mem;
+   int k, best = 0;
    
-   doCompact();
-   
-   /* now finish report */
-   putnum(qTail - qHead);
-   printf("/");
-   putnum(qTail);
-   printf("\n");
+   switchChecked = qHead;
+   for (k = 1; k < numShards; ++k)
+      if (shardBefore(&shards[k], &shards[best])) best = k;
+   mem.depth = nodeDepth(qHead);
+   mem.width = (params[P_BESTFIRST] == BEST_WIDTH) ? frontierWidth() - 16 : 0;
+   if (!shardBefore(&shards[best], &mem) || !spillQueue(1)) return 0;
+   return restoreShard();
+}
+
+static inline int deepenDue(void) {
+   return queueFull() || spillDue() || switchDue() || evictPending
+          || (params[P_EVERYDEPTH] && qHead == nextGeneration());
+}
+
+void allocProbes(void) {
+   if (!params[P_SPECULATE] || params[P_NUMTHREADS] < 2) return;
+   probeBits = (_Atomic uint64_t*)calloc(QSIZE/64 + 1, sizeof(*probeBits));
+   if (probeBits == 0)
+      printf("Unable to allocate memory for speculative deepening, speculative deepening disabled\n");
+   else trackMemory(MEM_OTHER, (QSIZE/64 + 1)*sizeof(*probeBits));
+}
+
+/* Called by threads other than thread 0 during speculativeBreadthFirst() */
+static void probeQueue(void) {
+   int i = currentDepth();
+   int increment = deepIncrement();
+   uint16_t howDeep = (uint16_t)((i >= lastDeep) ? increment : lastDeep + increment - i);
+   uint16_t **pInd = (uint16_t**)calloc(howDeep + 4 * params[P_PERIOD], sizeof(*pInd));
+   int *pRemain = (int*)calloc(howDeep + 4 * params[P_PERIOD], sizeof(*pRemain));
+   row *pRows = (row*)calloc(howDeep + 4 * params[P_PERIOD], sizeof(*pRows));
+   branchReserve(howDeep + 4 * params[P_PERIOD]);
    
-   /* Report successful/unsuccessful dump */
-   if (dumpFlag == DUMPSUCCESS) {
-      timeStamp();
-      printf("State dumped to %s\n",dumpFile);
-      if (dumpNum == DUMPLIMIT){
-         timeStamp();
-         printf("Sequential dump limit reached.  Changing to overwrite mode.\n");
+   while (!atomic_load_explicit(&probeStop, memory_order_relaxed)){
+      long long head = atomic_load_explicit(&probeHead, memory_order_relaxed);
+      long long limit = atomic_load_explicit(&probeLimit, memory_order_acquire);
+      long long next = atomic_load_explicit(&probeNext, memory_order_relaxed);
+      long long claim = next;
+      
+      /* Once the breadth-first search catches up, jump halfway down the queue */
+      if (claim <= head) claim = head + (limit - head) / 2 + 1;
+      if (claim >= limit) continue;
+      if (!atomic_compare_exchange_weak_explicit(&probeNext, &next, claim + 1,
+                                                 memory_order_relaxed, memory_order_relaxed))
+         continue;
+      if (EMPTY(claim)) continue;
+      
+      atomic_fetch_add_explicit(&probesRun, 1, memory_order_relaxed);
+      if (!probeDepthFirst((node)claim, howDeep, pInd, pRemain, pRows, &probeStop)){
+         atomic_fetch_or_explicit(&probeBits[claim >> 6], 1LLU << (claim & 63), memory_order_relaxed);
+         atomic_fetch_add_explicit(&probesPruned, 1, memory_order_relaxed);
       }
    }
-   else if (dumpFlag == DUMPFAILURE) {
-      timeStamp();
-      printf("State dump unsuccessful\n");
-      if (dumpMode == D_OVERWRITE)
-         dumpNum--;   /* reset dumpNum so that the next dump doesn't overwrite our "backup" */
-   }
-   dumpFlag = DUMPRESET;
+   free(pInd);
+   free(pRemain);
+   free(pRows);
+}
+
+/* Run the breadth-first search on thread 0 until it is time to deepen, */
+/* with the other threads searching ahead of it.                         */
+static void speculativeBreadthFirst(void) {
+   memset((void*)probeBits, 0, (QSIZE/64 + 1) * sizeof(*probeBits));
+   atomic_store_explicit(&probeNext, qHead, memory_order_relaxed);
+   atomic_store_explicit(&probeHead, qHead, memory_order_relaxed);
+   atomic_store_explicit(&probeLimit, qTail, memory_order_relaxed);
+   atomic_store_explicit(&probeStop, 0, memory_order_relaxed);
    
-   fflush(stdout);
+   #pragma omp parallel
+   {
+      if (omp_get_thread_num() == 0){
+         while (!aborting && !qIsEmpty() && !deepenDue()){
+            node x = dequeue();
+            if (atomic_load_explicit(&probeBits[x >> 6], memory_order_relaxed) & (1LLU << (x & 63))){
+               /* x has no extension, so drop it along with any saved extension */
+               uint32_t deepIndex = deepRowIndices[oldDeepQHead];
+               if (deepIndex > 1) freeDeepIndex(deepIndex);
+               deepRowIndices[oldDeepQHead] = 0;
+               ++probesDropped;
+            }
+            else
+               process(x);
+            atomic_store_explicit(&probeHead, qHead, memory_order_relaxed);
+            atomic_store_explicit(&probeLimit, qTail, memory_order_release);
+         }
+         atomic_store_explicit(&probeStop, 1, memory_order_relaxed);
+      }
+      else
+         probeQueue();
+   }
 }
 
 static void breadthFirst(void) {
-   while (!aborting && !qIsEmpty()){
-      if (qTail - qHead >= (1LLU<<params[P_DEPTHLIMIT]) || qTail >= QSIZE - QSIZE/16){
+   if (params[P_EXTBFS]){
+      externalBreadthFirst();
+      return;
+   }
+   if (params[P_IDDFS]){
+      iterativeDeepening();
+      return;
+   }
+   while (!aborting && (!qIsEmpty() || restoreShard())){
+      int spilled = 0;
+      if (evictPending) evictTable();
+      if (spillDue())
+         while (!aborting && qTail > QSIZE/2 && spillQueue(0)) spilled = 1;
+      if (spilled) continue;
+      if (switchDue() && switchFrontier()) continue;
+      if (queueFull()){
          timeStamp();
          printf("Queue full, depth ");
          deepen();
       }
-      else if (params[P_EVERYDEPTH] && qHead == nextRephase){
+      else if (params[P_EVERYDEPTH] && qHead == nextGeneration()){
          timeStamp();
          printf("Depth ");
          deepen();
       }
+      else if (probeBits)
+         speculativeBreadthFirst();
       else
          process(dequeue());
    }
 }
 
 /* Save rows from deepening step in pRows array (probably should be stored as a struct instead) */
-void saveDepthFirst(node theNode, uint32_t startRow, uint32_t howDeep, row *pRows) {
+void saveDepthFirst(node theNode, uint32_t startRow, uint32_t howDeep, row *pRows, int stale) {
    uint32_t theDeepIndex;
-   uint16_t totalDepth = (uint16_t) ((startRow + howDeep) & UINT16_MAX); /* truncate to fit in array */
-   #pragma omp critical(findDeepIndex)
-   {
-      theDeepIndex = 2;
-      while (theDeepIndex < 1LLU << (params[P_DEPTHLIMIT] + 1) && deepRows[theDeepIndex]) ++theDeepIndex;
-      if (theDeepIndex == 1LLU << (params[P_DEPTHLIMIT] + 1)){
-         fprintf(stderr,"Error: no available extension indices.\n");
-         aborting = 1;
-      }
-      if (!aborting){
-         deepRows[theDeepIndex] = (row*)calloc( totalDepth + 1 + 2,
-                                                sizeof(**deepRows) );
-      }
+   uint16_t numRows = (uint16_t) MIN(howDeep + 1, EXTMAXROWS);   /* truncate to fit in record */
+   theDeepIndex = newDeepIndex();
+   if (theDeepIndex == 0){
+      fprintf(stderr,"Error: no available extension indices.\n");
+      aborting = 1;
    }
    if (aborting) return;
    
-   memcpy( deepRows[theDeepIndex] + 2,
-           pRows,
-           (totalDepth + 1) * (long long)sizeof(**deepRows) );
-   
-   deepRows[theDeepIndex][0] = totalDepth;
-   deepRows[theDeepIndex][1] = (uint16_t) startRow;
+   row *e = deepAlloc(EXTLENGTH(numRows));
+   e[EXT_LEFT] = numRows;
+   e[EXT_USED] = stale ? EXT_STALE : 0;
+   setExtCheck(e, rowCheck(pRows + startRow - 2*period));
+   packRows(e + EXT_HEADER, pRows + startRow, numRows);
+   deepRows[theDeepIndex] = e;
    
    deepRowIndices[deepQHead + theNode - qHead] = theDeepIndex;
 }
 
+/* Flag the extensions of every node in the queue as saved under an */
+/* older order of the successor lists                               */
+void markStaleExtensions(void) {
+   node x;
+   for (x = qHead; x < qTail; ++x){
+      uint32_t i = deepRowIndices[deepQHead + x - qHead];
+      if (i > 1) deepRows[i][EXT_USED] |= EXT_STALE;
+   }
+}
+
 /* ========================== */
 /*  Print usage instructions  */
 /* ========================== */
@@ -1782,16 +5004,58 @@ void printHelp(void) {
 #endif
    printf("  -f, --found <number>          maximum number of spaceships to output\n");
    printf("  -i, --increment <number>      minimum deepening increment (default: 3)\n");
-   printf("  -g, --min-extension <number>  minimum length of saved extensions\n");
+   printf("  -g, --min-extension <number>  minimum length of saved extensions\n"
+          "                                (searches cut short by an early exit are\n"
+          "                                always saved so they can be resumed)\n");
    printf("  -n, --first-depth <number>    depth of first deepening step\n");
    printf("      --fixed-depth <number>    deepen at every new depth by the given amount\n");
+   printf("      --adaptive-deepening <number>\n"
+          "                                adjust the deepening increment between the\n"
+          "                                minimum (-i) and N to shrink the queue as fast\n"
+          "                                as possible (default: 0, disabled)\n");
+   printf("      --row-order <(natural|statistics|popcount|adaptive)>\n"
+          "                                order in which new rows are tried.  adaptive\n"
+          "                                starts from statistics and then sorts rows by\n"
+          "                                how often they led to extensions in the first\n"
+          "                                deepening steps (default: statistics)\n");
+   printf("      --branch-order <(table|fewest|most)>\n"
+          "                                order in which depth-first searches try the\n"
+          "                                rows of each list: as in the lookup table, or\n"
+          "                                fewest or most successors first (default: table)\n");
+   printf("      --portfolio <number>      run N searches at once (2 to %d), each with a\n"
+          "                                different row order, deepening increment,\n"
+          "                                cache size or branch order, and report which\n"
+          "                                finds a spaceship first.  -t threads are used\n"
+          "                                by each search.  (default: 0, disabled)\n", PORTFOLIOMAX);
+#ifndef QSIMPLE
+   printf("      --prune-subperiodic <number>\n"
+          "                                with --disable-subperiod, drop partial results\n"
+          "                                which are still subperiodic after N rows.\n"
+          "                                Spaceships with longer subperiodic front ends\n"
+          "                                are missed (default: 0, disabled)\n");
+#endif
    printf("  -e, --extend <filename>       file containing the initial rows for a search.\n"
           "                                Use the Golly script get-rows.lua to easily\n"
           "                                generate the initial rows file.\n");
+   printf("      --known <filename>        file of RLE spaceships (such as earlier results)\n"
+          "                                which are neither printed nor counted when found\n"
+          "                                again, in either orientation.  The search does\n"
+          "                                not continue behind them.  Each pattern starts\n"
+          "                                at an \"x = \" header line; other text is skipped.\n");
 #ifdef _OPENMP
    printf("  (--enable-early-exit|--disable-early-exit)\n"
           "                                enable/disable early exit during deepening step\n"
-          "                                when threads become idle (default: enabled)\n");
+          "                                when threads become idle (default: enabled)\n"
+          "                                Has no effect when work stealing is enabled.\n");
+   printf("  (--enable-work-stealing|--disable-work-stealing)\n"
+          "                                let idle threads take over part of the search\n"
+          "                                of a busy thread during deepening step\n"
+          "                                (default: enabled)\n");
+   printf("  (--enable-speculation|--disable-speculation)\n"
+          "                                search nodes near the front of the queue on\n"
+          "                                the other threads while the breadth-first\n"
+          "                                search continues, dropping nodes that have no\n"
+          "                                extension (default: disabled)\n");
 #endif
    printf("\n");
    printf("Memory options:\n");
@@ -1799,10 +5063,32 @@ void printHelp(void) {
           "                                cache (default: %d if speed is greater than c/5\n"
           "                                and disabled otherwise)\n"
           "                                Use -c 0 to disable lookahead caching.\n",DEFAULT_CACHEMEM);
-   printf("  -m, --mem-limit <number>      limits lookup table memory to N megabytes\n");
+   printf("      --memory-budget <number>  choose the queue bits (-q), hash bits (-h) and\n"
+          "                                cache memory (-c) to use about N megabytes in\n"
+          "                                total, and report memory use at each deepening\n"
+          "                                step.  The lookup table is stored in the\n"
+          "                                smaller form used with -m.\n");
+   printf("  -m, --mem-limit <number>      limits memory use to N megabytes, counting the\n"
+          "                                queue, hash tables, extensions and caches as\n"
+          "                                well as the lookup table.  Parts of the\n"
+          "                                lookup table that have not been used recently\n"
+          "                                are dropped when the limit is reached, and\n"
+          "                                parts with few successors are stored in a\n"
+          "                                smaller but slower form.\n");
+   printf("  (--enable-table-eviction|--disable-table-eviction)\n"
+          "                                drop unused parts of the lookup table when the\n"
+          "                                memory limit (-m) is reached, instead of\n"
+          "                                stopping the search (default: enabled)\n");
+   printf("  (--enable-shared-table|--disable-shared-table)\n"
+          "                                share one lookup table in POSIX shared memory\n"
+          "                                between qfind processes with the same rule,\n"
+          "                                width and symmetry (default: disabled)\n"
+          "                                The table is then never evicted.\n");
    printf("  -q, --queue-bits <number>     set BFS queue size to 2^N nodes (default: %d)\n", QBITS);
    printf("  -h, --hash-bits <number>      set hash table size to 2^N nodes (default: %d)\n"
           "                                Use -h 0 to disable duplicate elimination.\n", HASHBITS);
+   printf("      --memo-bits <number>      remember dead ends found while deepening in a\n"
+          "                                table of 2^N entries (default: 0, disabled)\n");
    printf("  -b, --base-bits <number>      groups 2^N queue entries to an index node\n"
           "                                (default: 4)\n");
    printf("\n");
@@ -1814,6 +5100,28 @@ void printHelp(void) {
    printf("  -l, --load <filename>         load search state from the given dump file\n");
    printf("  -j, --split <number>          split loaded search state into at most N files\n");
    printf("  -p, --preview                 preview partial results from the loaded state\n");
+   printf("  (--enable-spilling|--disable-spilling)\n"
+          "                                move subtrees of the queue to files named\n"
+          "                                <dump root>spillNNNNN when the queue is nearly\n"
+          "                                full, instead of deepening or aborting, and\n"
+          "                                search them once the queue in memory runs out\n"
+          "                                (default: disabled)\n");
+   printf("  (--enable-iddfs|--disable-iddfs)\n"
+          "                                search below a small breadth-first queue by\n"
+          "                                iterative-deepening depth-first search, which\n"
+          "                                needs little memory (default: disabled)\n");
+   printf("      --best-first <(off|depth|width)>\n"
+          "                                spill the queue as above, keeping the most\n"
+          "                                promising subtrees in memory, and search the\n"
+          "                                deepest or narrowest spilled subtrees first.\n"
+          "                                At each new depth the queue is swapped for a\n"
+          "                                spilled part that ranks higher; within the\n"
+          "                                queue the order stays breadth-first.\n"
+          "                                (default: off)\n");
+   printf("      --external-bfs <number>   keep each generation in a file named\n"
+          "                                <dump root>genNNNNN, removing duplicates by\n"
+          "                                sorting runs of N megabytes (default: 0,\n"
+          "                                disabled).  The search state is not dumped.\n");
    printf("\n");
    printf("Output options (enabled by default):\n");
 #ifndef QSIMPLE
@@ -1864,6 +5172,7 @@ void echoParams(void) {
    }
 #ifndef QSIMPLE
    if (params[P_FULLPERIOD] && gcd(period,offset)>1) printf("Suppress subperiodic results\n");
+   if (params[P_PRUNESUB] && gcd(period,offset)>1) printf("Prune subperiodic partial results at depth %d\n", params[P_PRUNESUB]);
 #endif
    if (params[P_DUMPMODE] != D_DISABLED){
       printf("Dump interval: %d second%s\n", params[P_DUMPINTERVAL], params[P_DUMPINTERVAL] == 1 ? "" : "s");
@@ -1873,9 +5182,12 @@ void echoParams(void) {
       printf("Dump disabled\n");
    printf("Queue size: 2^%d\n",params[P_QBITS]);
    printf("Hash table size: 2^%d\n",params[P_HASHBITS]);
+   if (params[P_MEMOBITS]) printf("Dead-end table size: 2^%d\n",params[P_MEMOBITS]);
    if (params[P_EVERYDEPTH])
       printf("Fixed deepening amount: %ld\n",
                params[P_FIRSTDEEP] ? (long)params[P_FIRSTDEEP] : lastDeep - currentDepth());
+   else if (params[P_ADAPTDEEP])
+      printf("Adaptive deepening increment: %d to %d\n",MINDEEP,params[P_ADAPTDEEP]);
    else
       printf("Minimum deepening increment: %d\n",MINDEEP);
    if (params[P_PRINTDEEP] == 0) printf("Output disabled while deepening\n");
@@ -1885,12 +5197,27 @@ void echoParams(void) {
    else
       printf("Lookahead caching disabled\n");
 #endif
-   if (params[P_MEMLIMIT] >= 0) printf("Memory limit: %d megabytes\n",params[P_MEMLIMIT]);
+   if (params[P_MEMBUDGET]) printf("Memory budget: %d megabytes\n",params[P_MEMBUDGET]);
+   if (params[P_MEMLIMIT] >= 0) printf("Memory limit: %d megabytes in total\n",params[P_MEMLIMIT]);
+   if (params[P_MEMLIMIT] >= 0 && (params[P_EVICT] == 0 || params[P_SHAREDTABLE])) printf("Lookup table eviction disabled\n");
+   if (params[P_SHAREDTABLE]) printf("Shared lookup table enabled\n");
 #ifdef _OPENMP
    printf("Number of threads: %d\n",params[P_NUMTHREADS]);
+   if (params[P_WORKSTEAL] == 0) printf("Work stealing disabled\n");
+   if (params[P_SPECULATE]) printf("Speculative deepening enabled\n");
 #endif
+   if (params[P_SPILL]) printf("Queue spilling to disk enabled\n");
+   if (params[P_IDDFS]) printf("Iterative-deepening depth-first search enabled\n");
+   if (params[P_BESTFIRST]) printf("Best-first search by %s\n", params[P_BESTFIRST] == BEST_DEPTH ? "depth" : "active width");
+   if (params[P_EXTBFS]) printf("External-memory search with %d megabyte runs\n", params[P_EXTBFS]);
    if (params[P_MINEXTENSION]) printf("Save depth-first extensions of length at least %d\n",params[P_MINEXTENSION]);
    if (params[P_LONGEST] == 0) printf("Printing of longest partial result disabled\n");
+   if (numKnown) printf("Known spaceships: %d from %s\n", knownLoaded, knownFile);
+   if (params[P_REORDER] != ORDER_STATS)
+      printf("Row order: %s\n", params[P_REORDER] == ORDER_NATURAL ? "natural" :
+                                params[P_REORDER] == ORDER_POPCOUNT ? "popcount" : "adaptive");
+   if (params[P_BRANCH] != BRANCH_TABLE)
+      printf("Branch order: %s successors first\n", params[P_BRANCH] == BRANCH_FEWEST ? "fewest" : "most");
    printf("\n");
 }
 
@@ -1913,20 +5240,17 @@ static void preview(void /*int allPhases*/) {
          uint32_t theDeepIndex = deepRowIndices[deepQHead + j - qHead];
          
          if (theDeepIndex > 1){
-            pRows = (row*) malloc((2*period + 1 + deepRows[theDeepIndex][0]
-                                   - deepRows[theDeepIndex][1] + 1) * (long long)sizeof(*pRows));
+            row *e = deepRows[theDeepIndex];
+            uint32_t currRow = 2*period + 1 + e[EXT_LEFT];
+            pRows = (row*) malloc(currRow * (long long)sizeof(*pRows));
             int m;
             node x = j;
             for (m = 2*period; m >= 0; --m){
                pRows[m] = ROW(x);
                x = PARENT(x);
             }
-            memcpy(pRows + 2*period+1,
-                   deepRows[theDeepIndex] + 2 + deepRows[theDeepIndex][1],
-                   (deepRows[theDeepIndex][0] - deepRows[theDeepIndex][1] + 1) * (long long)sizeof(*pRows));
-            uint32_t currRow = 2*period + 1  + deepRows[theDeepIndex][0]
-                                             - deepRows[theDeepIndex][1]
-                                             + 1;
+            for (m = 0; m < e[EXT_LEFT]; ++m)
+               pRows[2*period + 1 + m] = extRow(e, m);
             success(j, pRows, 2*period, currRow - 1);
             free(pRows);
          }
@@ -2191,6 +5515,48 @@ void checkParams(void) {
       printError("base bits (-b) must be less than queue bits (-q).");
    if (params[P_HASHBITS] < 0)
       printError("hash bits (-h) must be nonnegative.");
+   if (params[P_MEMOBITS] < 0 || params[P_MEMOBITS] > 40)
+      printError("dead-end table bits (--memo-bits) must be between 0 and 40.");
+   if (params[P_EXTBFS] < 0)
+      printError("external-memory run size (--external-bfs) must be nonnegative.");
+   if (params[P_MEMBUDGET] < 0)
+      printError("memory budget (--memory-budget) must be nonnegative.");
+   if (params[P_REORDER] < ORDER_NATURAL || params[P_REORDER] > ORDER_ADAPTIVE)
+      printError("invalid row order.");
+   if (params[P_BESTFIRST] < BEST_OFF || params[P_BESTFIRST] > BEST_WIDTH)
+      printError("invalid best-first heuristic.");
+   if (params[P_BESTFIRST] && params[P_EXTBFS])
+      printError("--best-first cannot be combined with --external-bfs.");
+   if (params[P_IDDFS] && (params[P_EXTBFS] || params[P_BESTFIRST]))
+      printError("--enable-iddfs cannot be combined with --external-bfs or --best-first.");
+   if (params[P_BRANCH] < BRANCH_TABLE || params[P_BRANCH] > BRANCH_MOST)
+      printError("invalid branch order.");
+   if (params[P_REORDER] == ORDER_ADAPTIVE && params[P_SHAREDTABLE])
+      printError("adaptive row order cannot be combined with --enable-shared-table,\n"
+                 "       since other processes use the same successor lists.");
+#ifndef SHAREDTABLE
+   if (params[P_SHAREDTABLE])
+      printError("shared lookup tables (--enable-shared-table) are not supported on\n"
+                 "       this system.");
+   if (params[P_PORTFOLIO])
+      printError("portfolio searches (--portfolio) are not supported on this system.");
+#endif
+   if (params[P_PRUNESUB] < 0)
+      printError("subperiodic pruning depth (--prune-subperiodic) must be nonnegative.");
+   if (params[P_PRUNESUB] && !params[P_FULLPERIOD])
+      printError("--prune-subperiodic requires --disable-subperiod.");
+   if (params[P_PORTFOLIO] && (params[P_PORTFOLIO] < 2 || params[P_PORTFOLIO] > PORTFOLIOMAX))
+      printError("portfolio size (--portfolio) must be between 2 and " XSTR(PORTFOLIOMAX) ".");
+   if (params[P_PORTFOLIO] && (params[P_SPILL] || params[P_BESTFIRST] || params[P_EXTBFS]))
+      printError("--portfolio cannot be combined with --enable-spilling, --best-first\n"
+                 "       or --external-bfs, since the searches would share their files.");
+   if (params[P_ADAPTDEEP] < 0)
+      printError("maximum adaptive deepening increment must be nonnegative.");
+   if (params[P_ADAPTDEEP] > 0 && params[P_ADAPTDEEP] < MINDEEP)
+      printError("maximum adaptive deepening increment must be at least the minimum\n"
+                 "       deepening increment (-i).");
+   if (params[P_ADAPTDEEP] && params[P_EVERYDEPTH])
+      printError("adaptive deepening cannot be combined with --fixed-depth.");
    
    /* Warnings */
    if (2 * params[P_OFFSET] > params[P_PERIOD] && params[P_PERIOD] > 0){
@@ -2302,6 +5668,28 @@ void loadState(void) {
    if (params[P_DUMPMODE] == D_SEQUENTIAL)
       dumpNum = 1;
    
+   /* Load list of spilled queue shards */
+   numShards = loadInt(fp);
+   if (numShards < 0) loadFail();
+   if (numShards > shardCap){
+      shardCap = numShards;
+      shards = (spillShard*)realloc(shards, shardCap * sizeof(*shards));
+      if (shards == 0) loadFail();
+   }
+   for (k = 0; k < numShards; ++k)
+      if (fscanf(fp,"%d %lu %d %255s\n",&shards[k].depth,&shards[k].nodes,&shards[k].width,shards[k].file) != 4)
+         loadFail();
+   
+   /* Load the learned row order, used by makeTables() */
+   if (loadInt(fp)){
+      loadedOrder = (uint16_t*)realloc(loadedOrder, sizeof(*loadedOrder) << width);
+      if (loadedOrder == 0) loadFail();
+      for (i = 0; i < 1UL << width; ++i){
+         j = loadUInt(fp);
+         if (j >= 1UL << width) loadFail();
+         loadedOrder[i] = (uint16_t) j;
+      }
+   }
    
    aborting        = 0;
    nRowsInState    = period+period;   /* how many rows needed to compute successor graph? */
@@ -2315,11 +5703,13 @@ void loadState(void) {
       printf("Unable to allocate BFS queue!\n");
       exit(1);
    }
+   trackMemory(MEM_QUEUE, (QSIZE>>BASEBITS)*sizeof(node) + QSIZE*sizeof(row));
    
    if (hashBits == 0) hash = 0;
    else {
       hash = (node*)malloc(HASHSIZE*sizeof(node));
       if (hash == 0) printf("Unable to allocate hash table, duplicate elimination disabled\n");
+      else trackMemory(MEM_HASH, HASHSIZE*sizeof(node));
    }
    
    /* Load up BFS queue */
@@ -2336,8 +5726,7 @@ void loadState(void) {
       rows[i] = (row) loadUInt(fp);
    
    /* Load extension rows for each queue node */
-   deepRows = (row**)calloc(1LLU << (params[P_DEPTHLIMIT] + 1), sizeof(*deepRows));
-   deepRowIndices = (uint32_t*)calloc(QSIZE, sizeof(deepRowIndices));
+   allocDeepRows();
    
    uint32_t theDeepIndex = 2;
    deepQTail = 0;
@@ -2353,11 +5742,18 @@ void loadState(void) {
          }
          continue;
       }
-      deepRows[theDeepIndex] = (row*)calloc( j + 1 + 2, sizeof(**deepRows));
-      deepRows[theDeepIndex][0] = (row) j;
-      for (i = 1; i < j + 1 + 2; ++i){
-         deepRows[theDeepIndex][i] = (row) loadUInt(fp);
+      k = (j & EXT_STALE) != 0;      /* saved under an older row order */
+      j &= ~(unsigned long)EXT_STALE;
+      if (theDeepIndex >= DEEPLIMIT || j == 0 || j > EXTMAXROWS)
+         loadFail();
+      row *e = deepAlloc(EXTLENGTH(j));
+      e[EXT_LEFT] = (row) j;
+      e[EXT_USED] = k ? EXT_STALE : 0;
+      for (i = 2; i < EXTLENGTH(j) - 1; ++i){
+         e[i] = (row) loadUInt(fp);
       }
+      e[i] = 0;
+      deepRows[theDeepIndex] = e;
       deepRowIndices[deepQTail] = theDeepIndex;
       ++theDeepIndex;
       ++deepQTail;
@@ -2422,7 +5818,7 @@ void setDefaultParams(void) {
 #endif
    params[P_WIDTH] = 0;
    params[P_SYMMETRY] = SYM_UNDEF;
-   params[P_REORDER] = 1;     /* 0 and 2 are also valid values, but this cannot currently be set at runtime. */
+   params[P_REORDER] = ORDER_STATS;
    params[P_DUMPINTERVAL] = 1800;    /* 30 minutes */
    params[P_BASEBITS] = 4;
    params[P_QBITS] = QBITS;
@@ -2444,6 +5840,20 @@ void setDefaultParams(void) {
    params[P_DUMPMODE] = D_OVERWRITE;
    params[P_EVERYDEPTH] = 0;
    params[P_EARLYEXIT] = 1;
+   params[P_WORKSTEAL] = 1;
+   params[P_MEMOBITS] = 0;    /* dead-end table disabled */
+   params[P_ADAPTDEEP] = 0;   /* adaptive deepening disabled */
+   params[P_SPECULATE] = 0;
+   params[P_SPILL] = 0;
+   params[P_EXTBFS] = 0;      /* external-memory search disabled */
+   params[P_MEMBUDGET] = 0;   /* sizes are set by -q, -h and -c */
+   params[P_EVICT] = 1;
+   params[P_SHAREDTABLE] = 0;
+   params[P_BRANCH] = BRANCH_TABLE;
+   params[P_BESTFIRST] = BEST_OFF;
+   params[P_IDDFS] = 0;
+   params[P_PORTFOLIO] = 0;
+   params[P_PRUNESUB] = 0;
 }
 
 /* =============== */
@@ -2644,6 +6054,7 @@ void parseOptions(int argc, char *argv[]) {
       {"enable-subperiodic",  no_argument,       257},
       {"disable-subperiod",   no_argument,       258},
       {"disable-subperiodic", no_argument,       258},
+      {"prune-subperiodic",   required_argument, 287},
 #endif
       {"enable-deep-print",   no_argument,       259},
       {"disable-deep-print",  no_argument,       260},
@@ -2651,9 +6062,30 @@ void parseOptions(int argc, char *argv[]) {
       {"disable-longest",     no_argument,       262},
       {"dump-mode",           required_argument, 263},
       {"fixed-depth",         required_argument, 264},
+      {"memo-bits",           required_argument, 269},
+      {"adaptive-deepening",  required_argument, 270},
+      {"enable-spilling",     no_argument,       273},
+      {"disable-spilling",    no_argument,       274},
+      {"external-bfs",        required_argument, 275},
+      {"memory-budget",       required_argument, 276},
+      {"enable-table-eviction",  no_argument,    277},
+      {"disable-table-eviction", no_argument,    278},
+      {"enable-shared-table", no_argument,       279},
+      {"disable-shared-table", no_argument,      280},
+      {"row-order",           required_argument, 281},
+      {"branch-order",        required_argument, 282},
+      {"best-first",          required_argument, 283},
+      {"enable-iddfs",        no_argument,       284},
+      {"disable-iddfs",       no_argument,       285},
+      {"portfolio",           required_argument, 286},
+      {"known",               required_argument, 288},
 #ifdef _OPENMP
       {"enable-early-exit",   no_argument,       265},
       {"disable-early-exit",  no_argument,       266},
+      {"enable-work-stealing",  no_argument,     267},
+      {"disable-work-stealing", no_argument,     268},
+      {"enable-speculation",    no_argument,     271},
+      {"disable-speculation",   no_argument,     272},
 #endif
       {0, 0, 0}   /* marks end of long options list */
    };
@@ -2705,6 +6137,9 @@ void parseOptions(int argc, char *argv[]) {
          case 258:   /* --disable-subperiod */
             params[P_FULLPERIOD] = 1;
             break;
+         case 287:   /* --prune-subperiodic */
+            params[P_PRUNESUB] = readInt(optName, optArg);
+            break;
 #endif
          case 'w': case 'W':
             params[P_WIDTH] = readInt(optName, optArg);
@@ -2795,6 +6230,9 @@ void parseOptions(int argc, char *argv[]) {
             initRows = optArg;
             initRowsFlag = 1;
             break;
+         case 288:   /* --known */
+            knownFile = optArg;
+            break;
          case 'l': case 'L':
             loadFile = optArg;
             loadDumpFlag = 1;
@@ -2843,6 +6281,98 @@ void parseOptions(int argc, char *argv[]) {
          case 266:   /* --disable-early-exit */
             params[P_EARLYEXIT] = 0;
             break;
+         case 267:   /* --enable-work-stealing */
+            params[P_WORKSTEAL] = 1;
+            break;
+         case 268:   /* --disable-work-stealing */
+            params[P_WORKSTEAL] = 0;
+            break;
+         case 269:   /* --memo-bits */
+            params[P_MEMOBITS] = readInt(optName, optArg);
+            break;
+         case 270:   /* --adaptive-deepening */
+            params[P_ADAPTDEEP] = readInt(optName, optArg);
+            break;
+         case 273:   /* --enable-spilling */
+            params[P_SPILL] = 1;
+            break;
+         case 274:   /* --disable-spilling */
+            params[P_SPILL] = 0;
+            break;
+         case 275:   /* --external-bfs */
+            params[P_EXTBFS] = readInt(optName, optArg);
+            break;
+         case 276:   /* --memory-budget */
+            params[P_MEMBUDGET] = readInt(optName, optArg);
+            break;
+         case 277:   /* --enable-table-eviction */
+            params[P_EVICT] = 1;
+            break;
+         case 278:   /* --disable-table-eviction */
+            params[P_EVICT] = 0;
+            break;
+         case 279:   /* --enable-shared-table */
+            params[P_SHAREDTABLE] = 1;
+            break;
+         case 280:   /* --disable-shared-table */
+            params[P_SHAREDTABLE] = 0;
+            break;
+         case 281:   /* --row-order */
+            switch(optArg[0]) {
+               case 'n': case 'N':
+                  params[P_REORDER] = ORDER_NATURAL; break;
+               case 's': case 'S':
+                  params[P_REORDER] = ORDER_STATS; break;
+               case 'p': case 'P':
+                  params[P_REORDER] = ORDER_POPCOUNT; break;
+               case 'a': case 'A':
+                  params[P_REORDER] = ORDER_ADAPTIVE; break;
+               default:
+                  optError("unrecognized row order ", optArg);
+                  break;
+            }
+            break;
+         case 282:   /* --branch-order */
+            switch(optArg[0]) {
+               case 't': case 'T':
+                  params[P_BRANCH] = BRANCH_TABLE; break;
+               case 'f': case 'F':
+                  params[P_BRANCH] = BRANCH_FEWEST; break;
+               case 'm': case 'M':
+                  params[P_BRANCH] = BRANCH_MOST; break;
+               default:
+                  optError("unrecognized branch order ", optArg);
+                  break;
+            }
+            break;
+         case 283:   /* --best-first */
+            switch(optArg[0]) {
+               case 'o': case 'O':
+                  params[P_BESTFIRST] = BEST_OFF; break;
+               case 'd': case 'D':
+                  params[P_BESTFIRST] = BEST_DEPTH; break;
+               case 'w': case 'W':
+                  params[P_BESTFIRST] = BEST_WIDTH; break;
+               default:
+                  optError("unrecognized best-first heuristic ", optArg);
+                  break;
+            }
+            break;
+         case 284:   /* --enable-iddfs */
+            params[P_IDDFS] = 1;
+            break;
+         case 285:   /* --disable-iddfs */
+            params[P_IDDFS] = 0;
+            break;
+         case 286:   /* --portfolio */
+            params[P_PORTFOLIO] = readInt(optName, optArg);
+            break;
+         case 271:   /* --enable-speculation */
+            params[P_SPECULATE] = 1;
+            break;
+         case 272:   /* --disable-speculation */
+            params[P_SPECULATE] = 0;
+            break;
          case 256:   /* --help */
             printHelp();
             break;
@@ -2863,12 +6393,367 @@ void parseOptions(int argc, char *argv[]) {
 /*  Set up search with the given parameters  */
 /* ========================================= */
 
+/* Choose the queue bits, hash bits and cache memory so that the search   */
+/* uses about params[P_MEMBUDGET] megabytes.  The lookup tables get enough */
+/* for every successor list of the width, up to half of the budget, the   */
+/* caches at most an eighth, and the queue, hash table and extensions the */
+/* rest.                                                                  */
+void sizeFromBudget(void) {
+   long long budget = (long long)params[P_MEMBUDGET] << 20;
+   long long tables = (long long)sizeof(*gInd3) << (2 * params[P_WIDTH]);
+   long long rest, perNode;
+   int threads = MAX(params[P_NUMTHREADS], 1);
+   int q;
+   
+   /* each list holds at most 2^(width+1) + 1 rows */
+   tables += (((2LL << params[P_WIDTH]) + 1) * (long long)sizeof(uint16_t)) << (2 * params[P_WIDTH]);
+   tables = MIN(tables, budget / 2);
+   rest = budget - tables;
+   
+#ifndef NOCACHE
+   if (params[P_CACHEMEM] > 0){
+      params[P_CACHEMEM] = (int)MIN((long long)DEFAULT_CACHEMEM, (budget >> 23) / threads);
+      rest -= ((long long)params[P_CACHEMEM] << 20) * threads;
+   }
+#endif
+   
+   if (params[P_MEMOBITS] > 0 && params[P_MEMOBITS] <= 40)
+      rest -= (1LL << params[P_MEMOBITS]) * (long long)sizeof(memoEntry);
+   
+   /* per queue node: the queue itself, its index and extension slots     */
+   /* (one for every four nodes), a guess at the extension rows, and the  */
+   /* hash table entry                                                    */
+   perNode = sizeof(row) + sizeof(*deepRowIndices) + 8
+           + (sizeof(*deepRows) + sizeof(*deepFreeNext)) / 4;
+   if (params[P_HASHBITS] > 0) perNode += sizeof(node);
+   
+   for (q = 31; q > params[P_BASEBITS] && (perNode << q) > rest; --q);
+   if (q <= params[P_BASEBITS] || (perNode << q) > rest){
+      fprintf(stderr, "Error: memory budget (--memory-budget) of %d megabytes is too small for\n"
+                      "       width %d.\n", params[P_MEMBUDGET], params[P_WIDTH]);
+      exit(1);
+   }
+   params[P_QBITS] = q;
+   if (params[P_HASHBITS] > 0) params[P_HASHBITS] = q;
+}
+
+/* ===================== */
+/*  Portfolio of searches  */
+/* ===================== */
+
+/* With --portfolio N, the search runs in N child processes at once, the
+** first with the options given and the others each with one change: a
+** different row order, twice the deepening increment, the lookahead cache
+** switched on or off, a different branch order or the adaptive row order.
+** The children are forked before the lookup table is built, since OpenMP
+** threads don't survive fork(), and those with the same row order share
+** one table as with --enable-shared-table.  Dumps are disabled in the
+** children.
+**
+** The parent prints the output of each child prefixed with its number,
+** prints each spaceship only the first time any child finds it, stops the
+** other children as soon as one finishes or -f spaceships have been found,
+** and reports which configuration found a new spaceship first.  SIGINT,
+** SIGTERM and SIGHUP sent to the parent stop the children in the same way.
+*/
+
+#define PF_GIVEN 0      /* configurations of a portfolio, in the order used */
+#define PF_ROWORDER 1
+#define PF_DEEPEN 2
+#define PF_CACHE 3
+#define PF_BRANCH 4
+#define PF_ADAPTIVE 5
+
+#ifdef SHAREDTABLE
+typedef struct {
+   pid_t pid;
+   int fd;               /* read end of the child's output, or -1 at end of file */
+   int config;
+   char desc[32];        /* the option which differs from those given */
+   char *out;            /* output not yet split into lines */
+   size_t outLen, outSize;
+   char *pattern;        /* pattern being read */
+   size_t patLen, patSize;
+   int inPattern, partial, newShips;
+   double firstShip;     /* seconds until its first new spaceship, or -1 */
+   double finished;      /* seconds until it finished its search, or -1 */
+} portfolioChild;
+
+portfolioChild *pfChildren;
+int pfNum;
+char **pfShips;          /* spaceships printed so far */
+int pfNumShips;
+double pfStart;
+
+/* List the configurations to run and describe how each differs */
+static int portfolioConfigs(int *config, char desc[][32]) {
+   int n = 0;
+   
+   config[n] = PF_GIVEN;
+   strcpy(desc[n++], "options as given");
+   config[n] = PF_ROWORDER;
+   strcpy(desc[n++], params[P_REORDER] == ORDER_POPCOUNT ? "--row-order statistics" : "--row-order popcount");
+   config[n] = PF_DEEPEN;
+   sprintf(desc[n++], "-i %d", 2 * MINDEEP);
+#ifndef NOCACHE
+   config[n] = PF_CACHE;
+   sprintf(desc[n++], "-c %d", params[P_CACHEMEM] ? 0 : DEFAULT_CACHEMEM);
+#endif
+   config[n] = PF_BRANCH;
+   strcpy(desc[n++], params[P_BRANCH] == BRANCH_TABLE ? "--branch-order fewest" : "--branch-order table");
+   if (params[P_REORDER] != ORDER_ADAPTIVE){
+      config[n] = PF_ADAPTIVE;
+      strcpy(desc[n++], "--row-order adaptive");
+   }
+   return n;
+}
+
+/* The parent only notes a signal, and stops the children outside the */
+/* handler; the children detach from the shared table as they exit.   */
+volatile sig_atomic_t pfSignal = 0;
+
+static void portfolioSignal(int sig) {
+   pfSignal = sig;
+}
+
+/* Set up a child for its configuration */
+static void portfolioApply(int config) {
+   switch (config){
+      case PF_ROWORDER:
+         params[P_REORDER] = params[P_REORDER] == ORDER_POPCOUNT ? ORDER_STATS : ORDER_POPCOUNT;
+         break;
+      case PF_DEEPEN:
+         params[P_MINDEEP] = 2 * MINDEEP;
+         if (params[P_ADAPTDEEP] && params[P_ADAPTDEEP] < params[P_MINDEEP])
+            params[P_ADAPTDEEP] = params[P_MINDEEP];
+         break;
+      case PF_CACHE:
+         params[P_CACHEMEM] = params[P_CACHEMEM] ? 0 : DEFAULT_CACHEMEM;
+         break;
+      case PF_BRANCH:
+         params[P_BRANCH] = params[P_BRANCH] == BRANCH_TABLE ? BRANCH_FEWEST : BRANCH_TABLE;
+         break;
+      case PF_ADAPTIVE:
+         params[P_REORDER] = ORDER_ADAPTIVE;
+         break;
+   }
+   params[P_SHAREDTABLE] = (params[P_REORDER] != ORDER_ADAPTIVE);
+   params[P_DUMPMODE] = D_DISABLED;
+   dumpMode = D_DISABLED;
+   params[P_PORTFOLIO] = 0;
+}
+
+static void stopPortfolio(void) {
+   int k;
+   for (k = 0; k < pfNum; ++k)
+      if (pfChildren[k].fd >= 0) kill(pfChildren[k].pid, SIGTERM);
+}
+
+/* Print a pattern read from child k unless it was found before */
+static void portfolioPattern(int k) {
+   portfolioChild *c = &pfChildren[k];
+   int i;
+   
+   if (c->partial){      /* the longest partial result of a finished child */
+      printf("\n%s\n", c->pattern);
+      c->partial = 0;
+      return;
+   }
+   for (i = 0; i < pfNumShips; ++i)
+      if (strcmp(pfShips[i], c->pattern) == 0) return;
+   pfShips = (char **)realloc(pfShips, (pfNumShips + 1) * sizeof(*pfShips));
+   pfShips[pfNumShips++] = strdup(c->pattern);
+   printf("\n%s\n", c->pattern);
+   if (!c->newShips++)
+      c->firstShip = wallClock() - pfStart;
+   if (params[P_NUMSHIPS] > 0 && pfNumShips >= params[P_NUMSHIPS])
+      stopPortfolio();
+}
+
+static void portfolioLine(int k, char *line) {
+   portfolioChild *c = &pfChildren[k];
+   size_t n = strlen(line);
+   
+   if (!c->inPattern && strncmp(line, "x = ", 4) == 0){
+      c->inPattern = 1;
+      c->patLen = 0;
+   }
+   if (c->inPattern){
+      if (c->patLen + n + 2 > c->patSize){
+         c->patSize = 2 * (c->patLen + n + 2);
+         c->pattern = (char *)realloc(c->pattern, c->patSize);
+      }
+      memcpy(c->pattern + c->patLen, line, n);
+      c->patLen += n;
+      c->pattern[c->patLen++] = '\n';
+      c->pattern[c->patLen] = '\0';
+      if (n && line[n - 1] == '!'){
+         c->inPattern = 0;
+         portfolioPattern(k);
+      }
+      return;
+   }
+   if (n == 0) return;   /* blank lines only surround patterns */
+   if (strcmp(line, "Longest partial result:") == 0) c->partial = 1;
+   printf("[%d] %s\n", k + 1, line);
+}
+
+/* Read what child k has written, returning 0 at end of file */
+static int portfolioRead(int k) {
+   portfolioChild *c = &pfChildren[k];
+   char *line, *end;
+   ssize_t got;
+   
+   if (c->outSize - c->outLen < 4096){
+      c->outSize = 2 * c->outSize + 4096;
+      c->out = (char *)realloc(c->out, c->outSize);
+   }
+   got = read(c->fd, c->out + c->outLen, c->outSize - c->outLen - 1);
+   if (got <= 0){
+      if (c->outLen){      /* a last line without a newline */
+         c->out[c->outLen] = '\0';
+         portfolioLine(k, c->out);
+         c->outLen = 0;
+      }
+      return 0;
+   }
+   c->outLen += got;
+   c->out[c->outLen] = '\0';
+   line = c->out;
+   while ((end = strchr(line, '\n')) != 0){
+      *end = '\0';
+      portfolioLine(k, line);
+      line = end + 1;
+   }
+   c->outLen -= line - c->out;
+   memmove(c->out, line, c->outLen);
+   fflush(stdout);
+   return 1;
+}
+
+static void portfolioReport(void) {
+   const char *what = (params[P_BOUNDARYSYM] == SYM_UNDEF) ? "spaceship" : "wave";
+   int k, best = -1;
+   
+   timeStamp();
+   printf(pfSignal ? "Portfolio stopped by a signal.\n\n" : "Portfolio complete.\n\n");
+   printf("%d %s%s found.\n", pfNumShips, what, pfNumShips == 1 ? "" : "s");
+   for (k = 0; k < pfNum; ++k){
+      portfolioChild *c = &pfChildren[k];
+      printf("[%d] %s: ", k + 1, c->desc);
+      if (c->newShips)
+         printf("%d new %s%s, first after %.2fs", c->newShips, what, c->newShips == 1 ? "" : "s", c->firstShip);
+      else
+         printf("no new %ss", what);
+      if (c->finished >= 0) printf(", finished after %.2fs\n", c->finished);
+      else printf(", stopped\n");
+      if (best < 0 || (c->newShips ? (!pfChildren[best].newShips || c->firstShip < pfChildren[best].firstShip)
+                                   : (!pfChildren[best].newShips && c->finished >= 0
+                                      && (pfChildren[best].finished < 0 || c->finished < pfChildren[best].finished))))
+         best = k;
+   }
+   if (pfChildren[best].newShips || pfChildren[best].finished >= 0)
+      printf("Fastest configuration: [%d] %s\n", best + 1, pfChildren[best].desc);
+}
+
+/* Fork the searches of the portfolio.  Returns in each child, set up for */
+/* its configuration; the parent follows the children and then exits.    */
+void startPortfolio(void) {
+   int config[PORTFOLIOMAX];
+   char desc[PORTFOLIOMAX][32];
+   struct pollfd fds[PORTFOLIOMAX];
+   struct sigaction sa;
+   int k, j, open, status, forwarded = 0;
+   
+   pfNum = MIN(params[P_PORTFOLIO], portfolioConfigs(config, desc));
+   pfChildren = (portfolioChild *)calloc(pfNum, sizeof(*pfChildren));
+   if (pfChildren == 0){
+      fprintf(stderr, "Error: unable to allocate memory for portfolio.\n");
+      exit(1);
+   }
+   printf("Running a portfolio of %d searches:\n", pfNum);
+   for (k = 0; k < pfNum; ++k)
+      printf("[%d] %s\n", k + 1, desc[k]);
+   printf("\n");
+   fflush(stdout);
+   
+   pfStart = wallClock();
+   for (k = 0; k < pfNum; ++k){
+      int p[2];
+      if (pipe(p) != 0){
+         fprintf(stderr, "Error: unable to create pipe for portfolio.\n");
+         exit(1);
+      }
+      pid_t pid = fork();
+      if (pid < 0){
+         fprintf(stderr, "Error: unable to start portfolio search.\n");
+         exit(1);
+      }
+      if (pid == 0){
+         for (j = 0; j < k; ++j)
+            close(pfChildren[j].fd);
+         close(p[0]);
+         dup2(p[1], STDOUT_FILENO);
+         close(p[1]);
+         free(pfChildren);
+         portfolioApply(config[k]);
+         return;
+      }
+      close(p[1]);
+      pfChildren[k].pid = pid;
+      pfChildren[k].fd = p[0];
+      pfChildren[k].config = config[k];
+      strcpy(pfChildren[k].desc, desc[k]);
+      pfChildren[k].firstShip = -1;
+      pfChildren[k].finished = -1;
+   }
+   
+   /* forward SIGINT, SIGTERM and SIGHUP to the children */
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = portfolioSignal;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, 0);
+   sigaction(SIGTERM, &sa, 0);
+   sigaction(SIGHUP, &sa, 0);
+   
+   /* copy the output of the children until they have all finished */
+   for (open = pfNum; open > 0; ){
+      if (pfSignal && !forwarded){
+         stopPortfolio();
+         forwarded = 1;
+      }
+      for (k = 0; k < pfNum; ++k){
+         fds[k].fd = pfChildren[k].fd;
+         fds[k].events = POLLIN;
+         fds[k].revents = 0;
+      }
+      if (poll(fds, pfNum, 1000) <= 0) continue;     /* wakes up to notice a signal */
+      for (k = 0; k < pfNum; ++k){
+         if (pfChildren[k].fd < 0 || !fds[k].revents || portfolioRead(k)) continue;
+         close(pfChildren[k].fd);
+         pfChildren[k].fd = -1;
+         --open;
+         waitpid(pfChildren[k].pid, &status, 0);
+         if (WIFEXITED(status) && WEXITSTATUS(status) == 0){
+            pfChildren[k].finished = wallClock() - pfStart;
+            stopPortfolio();     /* the others search the same space */
+         }
+      }
+   }
+   fflush(stdout);
+   portfolioReport();
+   exit(pfSignal ? 1 : 0);
+}
+#endif
+
 void searchSetup(void) {
    if (params[P_CACHEMEM] < 0){
       if (5 * params[P_OFFSET] > params[P_PERIOD]) params[P_CACHEMEM] *= -1;
       else params[P_CACHEMEM] = 0;
    }
    
+   if (params[P_MEMBUDGET] > 0) sizeFromBudget();
+   
    checkParams();  /* Exit if parameters are invalid */
    
    if (aborting){
@@ -2893,15 +6778,16 @@ void searchSetup(void) {
          printf("Unable to allocate BFS queue!\n");
          exit(1);
       }
+      trackMemory(MEM_QUEUE, (QSIZE>>BASEBITS)*sizeof(node) + QSIZE*sizeof(row));
       
       if (hashBits == 0) hash = 0;
       else {
          hash = (node*)malloc(HASHSIZE*sizeof(node));
          if (hash == 0) printf("Unable to allocate hash table, duplicate elimination disabled\n");
+         else trackMemory(MEM_HASH, HASHSIZE*sizeof(node));
       }
       
-      deepRows = (row**)calloc(1LLU << (params[P_DEPTHLIMIT] + 1), sizeof(*deepRows));
-      deepRowIndices = (uint32_t*)calloc(QSIZE, sizeof(deepRowIndices));
+      allocDeepRows();
       
       resetQ();
       resetHash();
@@ -2927,6 +6813,8 @@ void searchSetup(void) {
    }
    baseRule[j] = '\0';
    
+   if (knownFile) loadKnown(knownFile);
+   
    if (previewFlag){
       params[P_NUMSHIPS] = 0;
       preview();
@@ -2990,17 +6878,9 @@ void searchSetup(void) {
       node fixedQTail = qTail;
       
       /* delete the queue; we will reload it as needed */
-      free(base);
-      free(rows);
-      free(hash);
+      freeQueue();
       
-      uint32_t deepIndex;
-      for (deepIndex = 0; deepIndex < 1LLU << (params[P_DEPTHLIMIT] + 1); ++deepIndex){
-         if (deepRows[deepIndex]) free(deepRows[deepIndex]);
-         deepRows[deepIndex] = 0;
-      }
-      free(deepRows);
-      free(deepRowIndices);
+      freeDeepRows();
       
       node currNode = fixedQHead;
       
@@ -3010,6 +6890,7 @@ void searchSetup(void) {
          
          /* load the queue */
          loadState();
+         if (firstDumpNum) numShards = 0;   /* spilled shards go with the first piece */
          
          /* empty everything before currNode */
          j = deepQHead;
@@ -3057,22 +6938,18 @@ void searchSetup(void) {
          }
          
          /* free memory allocated in loadState() */
-         for (deepIndex = 0; deepIndex < 1LLU << (params[P_DEPTHLIMIT] + 1); ++deepIndex){
-            if (deepRows[deepIndex]) free(deepRows[deepIndex]);
-            deepRows[deepIndex] = 0;
-         }
-         
-         free(base);
-         free(rows);
-         free(hash);
-         free(deepRows);
-         free(deepRowIndices);
+         freeQueue();
+         freeDeepRows();
       }
       
       printf("Saved pieces in files %s%05d to %s\n",dumpRoot,firstDumpNum,dumpFile);
       exit(0);
    }
    
+#ifdef SHAREDTABLE
+   if (params[P_PORTFOLIO]) startPortfolio();
+#endif
+   
    omp_set_num_threads(params[P_NUMTHREADS]);
    
    memlimit = ((long long)params[P_MEMLIMIT]) << 20;
@@ -3082,8 +6959,8 @@ void searchSetup(void) {
    cachesize = 32768;
    while (cachesize * ((long long) sizeof(cacheentry)) < 550000 * (long long) params[P_CACHEMEM])
       cachesize <<= 1;
-   memusage += sizeof(cacheentry) * (cachesize + 5) * params[P_NUMTHREADS];
-   if (params[P_MEMLIMIT] >= 0 && memusage > memlimit){
+   trackMemory(MEM_CACHE, sizeof(cacheentry) * (cachesize + 5) * params[P_NUMTHREADS]);
+   if (overMemoryLimit()){
       printf("Not enough memory to allocate lookahead cache\n");
       exit(1);
    }
@@ -3095,25 +6972,57 @@ void searchSetup(void) {
       cache[k] = totalCache + (cachesize + 5) * k;
 #endif
    
+   allocMemo();
+   allocProbes();
+   allocBranches();
+   
    echoParams();
    
    fasterTable();
    makeTables();
+   printSetupTimes();
    
    rephase();
    
    parseDumpRoot();
    time(&lastDumpTime);
    
+   if (params[P_MEMBUDGET]) printMemory();
+   
    timeStamp();
 }
 
 void finalReport(void) {
    timeStamp();
-   printf("Search complete.\n\n");
+   printf(aborting == 4 ? "Search stopped by a signal.\n\n" : "Search complete.\n\n");
    
    printf("%d %s%s found.\n",numFound,(params[P_BOUNDARYSYM] == SYM_UNDEF) ? "spaceship" : "wave",(numFound == 1) ? "" : "s");
    printf("Maximum depth reached: %d\n",longest);
+   if (memo){
+      memoCounters total = {0, 0, 0, 0, {0}};
+      int t;
+      for (t = 0; t <= params[P_NUMTHREADS]; ++t){
+         total.lookups += memoStats[t].lookups;
+         total.hits += memoStats[t].hits;
+         total.stores += memoStats[t].stores;
+         total.evictions += memoStats[t].evictions;
+      }
+      printf("Dead-end table: %lld lookups, %lld hits, %lld stores, %lld evictions\n",
+             total.lookups, total.hits, total.stores, total.evictions);
+   }
+   if (numShards)
+      printf("%d spilled queue shard%s not searched\n", numShards, numShards == 1 ? "" : "s");
+   if (tableEvictions)
+      printf("Lookup table evicted %lld time%s, %lld parts dropped\n",
+             tableEvictions, tableEvictions == 1 ? "" : "s", tableEvicted);
+   if (probeBits)
+      printf("Speculative deepening: %lld nodes searched, %lld pruned, %lld dropped\n",
+             (long long)probesRun, (long long)probesPruned, probesDropped);
+   if (params[P_PRUNESUB])
+      printf("Subperiodic pruning: %lld queue nodes, %lld depth-first branches cut\n",
+             (long long)subperiodCuts[0], (long long)subperiodCuts[1]);
+   if (numKnown)
+      printf("%lld known spaceship%s skipped\n", knownSkipped, knownSkipped == 1 ? "" : "s");
    if (params[P_LONGEST] && aborting != 3){ /* aborting == 3 means we reached ship limit */
       if (patternBuf) printf("Longest partial result:\n\n%s",patternBuf);
       else printf("No partial results found.\n");
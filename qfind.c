@@ -210,7 +210,7 @@ int lookAhead(row *pRows, int a, int pPhase){
                uint16_t *p = getoffset2(row13, row23);
                for (ri22 = 0; ri22 < numRows22; ++ri22){
                   row22 = riStart22[ri22];
-                  if (p[row22+1]!=p[row22]) {
+                  if (hasSuccessors(p, row22)) {
 #ifndef NOCACHE
                      setkey(k, 1);
 #endif
@@ -345,8 +345,46 @@ int subperiodic(node x, row *pRows, int nodeRow, uint32_t lastRow){
    return 0;
 }
 
+/* With --prune-subperiodic N, partial results which are still subperiodic
+** at depth N are dropped, by process() for queue nodes and by the depth-
+** first searches for deeper rows.  Being subperiodic so far doesn't mean a
+** partial can only end as a subperiodic spaceship, so this is a heuristic:
+** full-period spaceships whose front ends are subperiodic for more than N
+** rows are lost.
+*/
+
+/* The row of pRows at depth N in searches below theNode, whose row is at */
+/* startRow - 1, or 0 if theNode is already deeper.                       */
+static uint32_t pruneRowBelow(node theNode, uint32_t startRow){
+   int d = params[P_PRUNESUB] - nodeDepth(theNode);
+   return (params[P_PRUNESUB] && d > 0 && gcd(period,offset) > 1) ? startRow - 1 + d : 0;
+}
+
 #endif
 
+/* Sort the n rows at *p, the successor list for row a of pRows, into the  */
+/* order set by --branch-order, and point *p at the sorted copy.  The key   */
+/* of each row is the count lookAhead() gets from its first lookup.         */
+static inline void orderBranches(row *pRows, uint32_t a, int pPhase, uint16_t **p, int n){
+#ifdef QSIMPLE
+   (void) pPhase;
+#endif
+   if (!branchBufs || n < 2) return;
+   branchBuffer *b = &branchBufs[omp_get_thread_num()];
+   uint16_t *list = b->lists + ((size_t)a << width);
+   const uint16_t *part = getoffset2(pRows[a - PERIOD - FWDOFF(pPhase)], pRows[a - FWDOFF(pPhase)]);
+   int i;
+   for (i = 0; i < n; ++i){
+      row r = (*p)[i];
+      uint32_t c = partCount(part, r);
+      list[i] = r;
+      if (params[P_BRANCH] == BRANCH_FEWEST && c) c = UINT32_MAX - c;
+      b->key[r] = c;
+   }
+   sortRowsBy(list, n, b->key, b->tmp);
+   *p = list;
+}
+
 /* 
 ** process() dequeues the node at the head of the queue and enqueues any valid
 ** child nodes.  Spaceships are detected by a call to terminal().
@@ -355,9 +393,9 @@ int subperiodic(node x, row *pRows, int nodeRow, uint32_t lastRow){
 void process(node theNode)
 {
    long long int i;
-   int firstRow = 0;
+   int firstRow = 0, skipRow = -1, stale = 0;
    int numRows;
-   int matchFlag = 1;
+   int matchFlag = 1, known;
    node x = theNode;
    int pPhase = peekPhase(x);
    row *riStart;
@@ -376,6 +414,8 @@ void process(node theNode)
                    pRows[currRow - PERIOD + BACKOFF(pPhase)],
                    &riStart,
                    &numRows );
+   branchReserve(currRow + 1);
+   orderBranches(pRows, currRow, pPhase, &riStart, numRows);
    
    /* we just ran dequeue() which changed DeepQHead so */
    /* we need to look at the previous head location    */
@@ -385,26 +425,23 @@ void process(node theNode)
       firstRow = 1;
    }
    else if (deepIndex > 1){  /* This means we have a saved extension for this node */
+      row *e = deepRows[deepIndex];
       
       /* Sanity check: do the extension rows match the node rows? */
-      node y = theNode;
-      for (i = 0; i < 2*period; ++i){
-         uint16_t startRow = deepRows[deepIndex][1] + 1;
-         if (deepRows[deepIndex][startRow - i] != ROW(y)){
-            fprintf(stderr, "Warning: non-matching rows detected at node %u in process()\n",theNode);
-            matchFlag = 0;
-            free(deepRows[deepIndex]);
-            deepRows[deepIndex] = 0;
-            break;
-         }
-         y = PARENT(y);
+      if (extCheck(e) != rowCheck(pRows + currRow - 2*period)){
+         fprintf(stderr, "Warning: non-matching rows detected at node %u in process()\n",theNode);
+         matchFlag = 0;
+         freeDeepIndex(deepIndex);
       }
       
       if (matchFlag){
-         uint16_t deepStart = deepRows[deepIndex][1] + 2;
-         ++deepRows[deepIndex][1];
+         stale = e[EXT_USED] & EXT_STALE;
+         pRows[currRow] = extRow(e, 0);
+         ++e[EXT_USED];
+         --e[EXT_LEFT];
+         setExtCheck(e, rowCheck(pRows + currRow + 1 - 2*period));
          
-         while (riStart[firstRow] != deepRows[deepIndex][deepStart]) ++firstRow;
+         while (riStart[firstRow] != pRows[currRow]) ++firstRow;
          if (!isVisited(theNode, riStart[firstRow])){
             enqueue(theNode, riStart[firstRow]);
             deepRowIndices[deepQTail - 1] = deepIndex;
@@ -412,62 +449,95 @@ void process(node theNode)
                if (params[P_LONGEST]) bufferPattern(qTail-1, NULL, 0, 0, 0);
                longest = currentDepth();
             }
-            if (terminal(qTail-1) && !terminal(PARENT(qTail-1))) success(qTail-1, NULL, 0, 0);
+            known = terminal(qTail-1) && !terminal(PARENT(qTail-1)) && success(qTail-1, NULL, 0, 0);
             setVisited(qTail - 1);
-            if (deepRows[deepIndex][1] > deepRows[deepIndex][0]){
+            if (known){    /* don't search behind a known spaceship */
+               MAKEEMPTY(qTail - 1);
+               e[EXT_LEFT] = 0;
+            }
+            if (e[EXT_LEFT] == 0){
                deepRowIndices[deepQTail - 1] = 0;
             }
          }
          else     /* flag extension for elimination if it produces a previously seen node */
-            deepRows[deepIndex][1] = deepRows[deepIndex][0] + 1;  /* extension will be eliminated by subsequent length check */
+            e[EXT_LEFT] = 0;  /* extension will be eliminated by subsequent length check */
          
          /* eliminate extension if it gets too short */
-         if (deepRows[deepIndex][1] > deepRows[deepIndex][0]){
-            free(deepRows[deepIndex]);
-            deepRows[deepIndex] = 0;
+         if (e[EXT_LEFT] == 0){
+            freeDeepIndex(deepIndex);
          }
          ++firstRow;
+         
+         /* The rows before the extension's row were searched when it was */
+         /* found, unless the lists have been reordered since.            */
+         if (stale){
+            skipRow = firstRow - 1;
+            firstRow = 0;
+         }
       }
    }
    
    /* This is no longer in the queue, so we can clear it */
    deepRowIndices[oldDeepQHead] = 0;
    
+#ifndef QSIMPLE
+   int prune = (pruneRowBelow(theNode, currRow) == (uint32_t)currRow);
+#endif
+   
    for (i = firstRow; i < numRows; ++i){
+      if (i == skipRow) continue;
       pRows[currRow] = riStart[i];
       if (!isVisited(theNode, pRows[currRow]) && lookAhead(pRows, currRow, pPhase)){
+#ifndef QSIMPLE
+         if (prune && subperiodic(theNode, pRows, currRow - 1, currRow)){
+            atomic_fetch_add_explicit(&subperiodCuts[0], 1, memory_order_relaxed);
+            continue;
+         }
+#endif
          enqueue(theNode, pRows[currRow]);
          if (currentDepth() > longest){
             if (params[P_LONGEST]) bufferPattern(qTail-1, NULL, 0, 0, 0);
             longest = currentDepth();
          }
-         if (terminal(qTail-1) && !terminal(PARENT(qTail-1))) success(qTail-1, NULL, 0, 0);
+         known = terminal(qTail-1) && !terminal(PARENT(qTail-1)) && success(qTail-1, NULL, 0, 0);
          setVisited(qTail - 1);
+         if (known) MAKEEMPTY(qTail - 1);
       }
    }
 }
 
-int reloadDepthFirst(uint16_t startRow, int pPhase, uint16_t howDeep, row *pRows, uint16_t **pIndGen, int *pRemainGen, row *pRowsGen){
+/* Restore the state of an earlier depth-first search from extension e.  */
+/* The rows before the saved row in each successor list have already     */
+/* been searched, so the search carries on with the rows after it.       */
+int reloadDepthFirst(uint16_t startRow, int pPhase, uint16_t howDeep, row *e, uint16_t **pIndGen, int *pRemainGen, row *pRowsGen){
    uint16_t currRow = startRow;
+   uint32_t i;
+   int stale = e[EXT_USED] & EXT_STALE;
    
    /* Return value if length of extension is greater than deepening amount */
-   if (pRows[0] >= howDeep + pRows[1]) return 1;
+   if (e[EXT_LEFT] > howDeep) return 1;
    
-   memcpy(pRowsGen + startRow, pRows + 2 + pRows[1], (pRows[0] - pRows[1] + 1) * (long long)sizeof(*pRowsGen));
+   for (i = 0; i < e[EXT_LEFT]; ++i)
+      pRowsGen[startRow + i] = extRow(e, i);
    
-   for (currRow = startRow; currRow <= startRow + (pRows[0] - pRows[1]); ++currRow){
+   for (currRow = startRow; currRow < startRow + e[EXT_LEFT]; ++currRow){
       getoffsetcount( pRowsGen[currRow - 2 * PERIOD],
                       pRowsGen[currRow - PERIOD],
                       pRowsGen[currRow - PERIOD + BACKOFF(pPhase)],
                       &(pIndGen[currRow]),
                       &(pRemainGen[currRow]) );
+      orderBranches(pRowsGen, currRow, pPhase, &(pIndGen[currRow]), pRemainGen[currRow]);
       
       pIndGen[currRow] += pRemainGen[currRow];
       
-      while (*(pIndGen[currRow] - pRemainGen[currRow]) != pRowsGen[currRow]){
+      /* If the lists were reordered after e was saved, every row at this */
+      /* level is tried again, including the saved one.                   */
+      if (!stale){
+         while (*(pIndGen[currRow] - pRemainGen[currRow]) != pRowsGen[currRow]){
+            --pRemainGen[currRow];
+         }
          --pRemainGen[currRow];
       }
-      --pRemainGen[currRow];
       
       ++pPhase;
       if (pPhase == period) pPhase = 0;
@@ -475,6 +545,283 @@ int reloadDepthFirst(uint16_t startRow, int pPhase, uint16_t howDeep, row *pRows
    return 0;
 }
 
+/* Claim the search of c->theNode as successful.  Returns 0 if another */
+/* piece of the same search has already claimed it.                    */
+static int claimNode(dfsContext *c){
+   return !c->job || !atomic_exchange_explicit(&c->job->found, 1, memory_order_acq_rel);
+}
+
+/* Main loop of the depth-first search.  Returns 1 if the search of c->theNode */
+/* should stop because an extension was found (or we are exiting early) and 0  */
+/* if every row at baseRow has been tried.                                     */
+static int dfsLoop(dfsContext *c, uint32_t currRow, int pPhase){
+   uint16_t **pInd = c->pInd;
+   int *pRemain = c->pRemain;
+   row *pRows = c->pRows;
+   uint32_t startRow = c->startRow;
+   uint32_t howDeep = c->howDeep;
+   node theNode = c->theNode;
+   stealSlot *mySlot = stealSlots ? &stealSlots[omp_get_thread_num()] : 0;
+   int i;
+#ifdef QSIMPLE
+   (void) pPhase;
+#endif
+   
+   for (;;){
+      /* Answer requests for work from idle threads */
+      if (mySlot){
+         if (atomic_load_explicit(&mySlot->request, memory_order_relaxed) >= 0)
+            donateWork(c, currRow);
+         if (c->job && atomic_load_explicit(&c->job->found, memory_order_relaxed))
+            return 1;
+      }
+      
+      /* Back up if there are no rows left to check at this depth */
+      if (!pRemain[currRow]){
+         if (currRow <= c->dirtyLevel)
+            c->dirtyLevel = currRow - 1;
+         else if (memo)    /* every row here failed, so remember the dead end */
+            memoStore(pRows + currRow, MEMOPHASE(pPhase), startRow + howDeep + 1 - currRow);
+         --currRow;
+         
+         /* The next row here comes from the start of the current list, so */
+         /* this level no longer holds a row from a stale extension         */
+         if (currRow < c->staleLevel) c->staleLevel = currRow;
+#ifndef QSIMPLE   /* The value of pPhase doesn't matter for QSIMPLE, so avoid calculating it in the main loop. */
+         if (pPhase == 0) pPhase = period;
+         --pPhase;
+#endif
+         if (currRow < c->baseRow) return 0;
+         
+         continue;
+      }
+      
+      /* Check next row with fixed-depth look ahead and add it if it passes */
+      pRows[currRow] = *(pInd[currRow] - pRemain[currRow]);
+      --pRemain[currRow];
+      if (!lookAhead(pRows, currRow, pPhase))
+         continue;
+      
+      ++currRow;
+#ifndef QSIMPLE   /* The value of pPhase doesn't matter for QSIMPLE, so avoid calculating it in the main loop. */
+      ++pPhase;
+      if (pPhase == period) pPhase = 0;
+      
+      /* Cut off a partial result which is still subperiodic at depth N.  */
+      /* That depends on more than the rows the dead-end table looks at,  */
+      /* so the levels above are marked as not complete.                 */
+      if (currRow - 1 == c->pruneRow && subperiodic(theNode, pRows, startRow - 1, currRow - 1)){
+         atomic_fetch_add_explicit(&subperiodCuts[1], 1, memory_order_relaxed);
+         --currRow;
+         if (pPhase == 0) pPhase = period;
+         --pPhase;
+         if (c->dirtyLevel < currRow) c->dirtyLevel = currRow;
+         continue;
+      }
+#endif
+      
+      /* Test for early exit conditions.  Idle threads steal work instead */
+      /* when work stealing is enabled.                                   */
+      if ( atomic_load_explicit(c->forceExit, memory_order_relaxed)
+           || (   params[P_EARLYEXIT]
+               && !mySlot
+               && atomic_load_explicit(c->remainingItems, memory_order_relaxed) < c->earlyExit
+               && atomic_load_explicit(c->passed, memory_order_relaxed) ) )
+         {
+         if (c->probe) return 1;   /* no answer, so keep the node */
+         if (!claimNode(c)) return 1;
+         
+         /* Save the current path whatever its length.  Rows are tried in the  */
+         /* order of the successor lists, so the saved row at each level marks */
+         /* how far that level got, and reloadDepthFirst() resumes the search  */
+         /* from there without repeating any finished subtree.                 */
+         deepRowIndices[deepQHead + theNode - qHead] = 1;
+         saveDepthFirst(theNode, startRow, currRow - startRow - 1, pRows, c->staleLevel > startRow);
+         return 1;
+      }
+      
+      /* Check if we reached the desired depth. If so,  
+         check if the result is a complete spaceship */
+      if (currRow > startRow + howDeep){
+         /* Increment successful depth-first counter (used in early exit check) */
+         atomic_fetch_add_explicit(c->passed, 1, memory_order_relaxed);
+         
+         if (c->probe) return 1;
+         if (!claimNode(c)) return 1;
+         if (rowCredit) creditRows(pRows + startRow, howDeep + 1);
+         
+         /* Flag that an extension was found. This value will be changed by saveDepthFirst() */
+         deepRowIndices[deepQHead + theNode - qHead] = 1;
+         
+         /* Save the extension if it is long enough */
+         if (howDeep >= (uint32_t) params[P_MINEXTENSION]){
+            saveDepthFirst(theNode, startRow, howDeep, pRows, c->staleLevel > startRow);
+         }
+         
+         /* Check if the extension represents a spaceship */
+         if (params[P_PRINTDEEP] == 0) return 1;
+         for (i = 1; i <= PERIOD; ++i){
+            if (pRows[currRow - i]) return 1;
+         }
+         currRow -= PERIOD;
+         for (i = 1; i <= PERIOD; ++i){
+            if (causesBirth[pRows[currRow - i]]) return 1;
+         }
+         
+         /* If we got here, then we found a spaceship! */
+         #pragma omp critical(printWhileDeepening)
+         {
+            success(theNode, pRows, startRow - 1, currRow + PERIOD - 1);
+         }
+         if (aborting)  /* Flag for early exit if the desired number of ships has been found */
+            atomic_store_explicit(c->forceExit, 1, memory_order_seq_cst);
+         return 1;
+      }
+      
+      /* Skip rows that are known to lead to a dead end */
+      if (memo && memoDead(pRows + currRow, MEMOPHASE(pPhase), startRow + howDeep + 1 - currRow)){
+         --currRow;
+#ifndef QSIMPLE
+         if (pPhase == 0) pPhase = period;
+         --pPhase;
+#endif
+         continue;
+      }
+      
+      /* Get the list of successor rows based on the newly added row */
+      getoffsetcount(pRows[currRow - 2 * PERIOD],
+                     pRows[currRow - PERIOD],
+                     pRows[currRow - PERIOD + BACKOFF(pPhase)],
+                     &(pInd[currRow]), &(pRemain[currRow]));
+      orderBranches(pRows, currRow, pPhase, &(pInd[currRow]), pRemain[currRow]);
+      pInd[currRow] += pRemain[currRow];
+   }
+}
+
+/* ================================ */
+/*  Work stealing during deepening  */
+/* ================================ */
+
+/* Work stealing lets idle threads take over untried rows from depth-first
+** searches that are still running.  A thread which has run out of queue
+** nodes writes its number into the request slot of a busy thread.  The busy
+** thread sees the request in dfsLoop() and hands over the later half of the
+** untried rows at its shallowest level, together with the rows leading up to
+** that level.  The node passes as soon as any piece of its search finds an
+** extension, and the last piece to finish empties the node if none did.
+*/
+
+static void openSteal(void){
+   if (stealSlots)
+      atomic_store_explicit(&stealSlots[omp_get_thread_num()].request, STEAL_OPEN, memory_order_release);
+}
+
+/* Stop accepting requests, turning away any thread still waiting on us */
+static void closeSteal(void){
+   if (!stealSlots) return;
+   int thief = atomic_exchange_explicit(&stealSlots[omp_get_thread_num()].request, STEAL_CLOSED, memory_order_acq_rel);
+   if (thief >= 0)
+      atomic_store_explicit(&stealSlots[thief].reply, STEAL_NONE, memory_order_release);
+}
+
+void donateWork(dfsContext *c, uint32_t currRow){
+   int thief = atomic_exchange_explicit(&stealSlots[omp_get_thread_num()].request, STEAL_OPEN, memory_order_acq_rel);
+   if (thief < 0) return;
+   stealSlot *s = &stealSlots[thief];
+   uint32_t level;
+   int count;
+   
+   for (level = c->baseRow; level <= currRow && !c->pRemain[level]; ++level);
+   if (level > currRow){
+      atomic_store_explicit(&s->reply, STEAL_NONE, memory_order_release);
+      return;
+   }
+   if (!c->job){
+      c->job = (dfsJob*)malloc(sizeof(*c->job));
+      if (!c->job){
+         atomic_store_explicit(&s->reply, STEAL_NONE, memory_order_release);
+         return;
+      }
+      c->job->theNode = c->theNode;
+      atomic_init(&c->job->pending, 1);
+      atomic_init(&c->job->found, 0);
+   }
+   atomic_fetch_add_explicit(&c->job->pending, 1, memory_order_relaxed);
+   atomic_fetch_add_explicit(&stealActive, 1, memory_order_relaxed);
+   
+   count = (c->pRemain[level] + 1) / 2;
+   memcpy(s->rows, c->pRows, level * sizeof(*c->pRows));
+   s->gift = *c;
+   s->gift.baseRow = level;
+   s->gift.dirtyLevel = level;      /* the thief only gets some of the rows at level */
+   if (c->dirtyLevel < level)
+      c->dirtyLevel = level;
+   s->giftEnd = c->pInd[level];
+   s->giftCount = count;
+   if (branchBufs){   /* our copy of the list may be overwritten before the thief is done */
+      uint16_t *list = branchBufs[thief].lists + ((size_t)level << width);
+      memcpy(list, s->giftEnd - count, count * sizeof(*list));
+      s->giftEnd = list + count;
+   }
+   c->pInd[level] -= count;
+   c->pRemain[level] -= count;
+   atomic_store_explicit(&s->reply, STEAL_WORK, memory_order_release);
+}
+
+/* Called by every piece of a search when it stops.  Returns the value */
+/* depthFirst() should return for a search which was never split.      */
+static int finishPiece(dfsContext *c, int result){
+   dfsJob *job = c->job;
+   if (!job) return result;
+   if (result) atomic_store_explicit(&job->found, 1, memory_order_relaxed);
+   if (atomic_fetch_sub_explicit(&job->pending, 1, memory_order_acq_rel) == 1){
+      if (!atomic_load_explicit(&job->found, memory_order_relaxed))
+         MAKEEMPTY(job->theNode);
+      free(job);
+   }
+   return 1;   /* the last piece to finish empties the node if needed */
+}
+
+/* Ask busy threads for work until no thread is busy */
+void stealWork(uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *remainingItems, _Atomic int *forceExit, _Atomic int *passed){
+   int me = omp_get_thread_num();
+   int numThreads = omp_get_num_threads();
+   int victim = me;
+   int r;
+   stealSlot *s = &stealSlots[me];
+   
+   while ( atomic_load_explicit(&stealActive, memory_order_acquire) > 0
+           && !atomic_load_explicit(forceExit, memory_order_relaxed) ){
+      int open = STEAL_OPEN;
+      victim = (victim + 1) % numThreads;
+      if (victim == me || atomic_load_explicit(&stealSlots[victim].request, memory_order_relaxed) != STEAL_OPEN)
+         continue;
+      atomic_store_explicit(&s->reply, STEAL_WAIT, memory_order_relaxed);
+      if (!atomic_compare_exchange_strong_explicit(&stealSlots[victim].request, &open, me,
+                                                   memory_order_acq_rel, memory_order_relaxed))
+         continue;
+      while ((r = atomic_load_explicit(&s->reply, memory_order_acquire)) == STEAL_WAIT);
+      if (r != STEAL_WORK) continue;
+      
+      dfsContext c = s->gift;
+      uint32_t level = c.baseRow;
+      c.pInd = pInd;
+      c.pRemain = pRemain;
+      c.pRows = pRows;
+      c.remainingItems = remainingItems;
+      c.forceExit = forceExit;
+      c.passed = passed;
+      pInd[level] = s->giftEnd;
+      pRemain[level] = s->giftCount;
+      
+      openSteal();
+      r = dfsLoop(&c, level, (c.startPhase + level - c.startRow) % period);
+      closeSteal();
+      finishPiece(&c, r);
+      atomic_fetch_sub_explicit(&stealActive, 1, memory_order_release);
+   }
+}
+
 int depthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *remainingItems, _Atomic int *forceExit, _Atomic int *passed){
    int pPhase = peekPhase(theNode);
    node x = theNode;
@@ -489,15 +836,34 @@ int depthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, ro
    ++pPhase;
    if (pPhase == period) pPhase = 0;
    
+   dfsContext c;
+   c.theNode = theNode;
+   c.startRow = startRow;
+   c.baseRow = startRow;
+   c.dirtyLevel = startRow - 1;
+   c.staleLevel = startRow;
+#ifndef QSIMPLE
+   c.pruneRow = pruneRowBelow(theNode, startRow);
+#else
+   c.pruneRow = 0;
+#endif
+   c.howDeep = howDeep;
+   c.startPhase = pPhase;
+   c.earlyExit = MIN(params[P_NUMTHREADS], (int) (qTail - qHead)/4);
+   c.pInd = pInd;
+   c.pRemain = pRemain;
+   c.pRows = pRows;
+   c.remainingItems = remainingItems;
+   c.forceExit = forceExit;
+   c.passed = passed;
+   c.job = 0;
+   c.probe = 0;
+   
    /* Reload state if we have a previous extension */
    int matchFlag = 1;
    uint32_t theDeepIndex = deepRowIndices[deepQHead + theNode - qHead];
    if (theDeepIndex > 1){
-      row *theDeepRows;
-      #pragma omp critical(findDeepIndex)
-      {
-         theDeepRows = deepRows[theDeepIndex];
-      }
+      row *theDeepRows = deepRows[theDeepIndex];
       if (reloadDepthFirst( (uint16_t) startRow,
                             pPhase,
                             howDeep,
@@ -510,27 +876,17 @@ int depthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, ro
       }
       
       /* Sanity check: do the extension rows match the node rows? */
-      node y = theNode;
-      for (i = 0; i < 2*PERIOD; ++i){
-         if (theDeepRows[theDeepRows[1] + 1 - i] != ROW(y)){
-            fprintf(stderr, "Warning: non-matching rows detected at node %u in depthFirst()\n",theNode);
-            matchFlag = 0;
-            break;
-         }
-         y = PARENT(y);
+      if (extCheck(theDeepRows) != rowCheck(pRows + startRow - 2*PERIOD)){
+         fprintf(stderr, "Warning: non-matching rows detected at node %u in depthFirst()\n",theNode);
+         matchFlag = 0;
       }
       
       if (matchFlag){
-         currRow = startRow   + theDeepRows[0]
-                              - theDeepRows[1]
-                              + 1;
+         currRow = startRow + theDeepRows[EXT_LEFT];
+         if (theDeepRows[EXT_USED] & EXT_STALE) c.staleLevel = currRow;
          pPhase = (pPhase + currRow - startRow) % period;
          
-         #pragma omp critical(findDeepIndex)
-         {
-            free(deepRows[theDeepIndex]);
-            deepRows[theDeepIndex] = 0;
-         }
+         freeDeepIndex(theDeepIndex);
       }
    }
    
@@ -541,90 +897,335 @@ int depthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, ro
                    pRows[currRow - PERIOD + BACKOFF(pPhase)],
                    &(pInd[currRow]),
                    &(pRemain[currRow]) );
+   orderBranches(pRows, currRow, pPhase, &(pInd[currRow]), pRemain[currRow]);
+   pInd[currRow] += pRemain[currRow];
+   
+   openSteal();
+   int result = dfsLoop(&c, currRow, pPhase);
+   closeSteal();
+   return finishPiece(&c, result);
+}
+
+/* Depth-first search which saves nothing and never touches the queue.   */
+/* pRows must hold the 2*period rows before startRow, and pPhase is the  */
+/* phase of startRow.  Returns 0 if there is no extension of howDeep     */
+/* rows, and 1 if there is one or the search was stopped.               */
+int probeRows(uint32_t startRow, int pPhase, uint16_t howDeep, uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *stop){
+   _Atomic int idle = 0;
+   _Atomic int passed = 0;
+   
+   dfsContext c;
+   c.theNode = 0;
+   c.startRow = startRow;
+   c.baseRow = startRow;
+   c.dirtyLevel = startRow - 1;
+   c.staleLevel = startRow;
+   c.pruneRow = 0;
+   c.howDeep = howDeep;
+   c.startPhase = pPhase;
+   c.earlyExit = 0;
+   c.pInd = pInd;
+   c.pRemain = pRemain;
+   c.pRows = pRows;
+   c.remainingItems = &idle;
+   c.forceExit = stop;
+   c.passed = &passed;
+   c.job = 0;
+   c.probe = 1;
+   
+   getoffsetcount( pRows[startRow - 2 * PERIOD],
+                   pRows[startRow - PERIOD],
+                   pRows[startRow - PERIOD + BACKOFF(pPhase)],
+                   &(pInd[startRow]),
+                   &(pRemain[startRow]) );
+   orderBranches(pRows, startRow, pPhase, &(pInd[startRow]), pRemain[startRow]);
+   pInd[startRow] += pRemain[startRow];
+   
+   return dfsLoop(&c, startRow, pPhase);
+}
+
+/* Depth-first search used by speculative deepening.  It runs while the    */
+/* breadth-first search is changing the queue, so it only reads theNode    */
+/* and its ancestors and works out the phase from the ancestry instead of  */
+/* with peekPhase().  Returns 0 if theNode has no extension of howDeep     */
+/* rows.                                                                   */
+int probeDepthFirst(node theNode, uint16_t howDeep, uint16_t **pInd, int *pRemain, row *pRows, _Atomic int *stop){
+   node x = theNode;
+   uint32_t startRow = 2*PERIOD + 1;
+   int pPhase = period - 1;
+   
+   int i;
+   for (i = startRow - 1; i >= 0; --i){
+      pRows[i] = ROW(x);
+      x = PARENT(x);
+   }
+   for (x = theNode; x != 0; x = PARENT(x))
+      ++pPhase;
+   pPhase = (pPhase + 1) % period;
+   
+   return probeRows(startRow, pPhase, howDeep, pInd, pRemain, pRows, stop);
+}
+
+/* Test whether the rows before row r end a spaceship, as terminal() does */
+/* for queue nodes.                                                       */
+static int shipEnds(row *pRows, uint32_t r){
+   int i;
+   for (i = 1; i <= PERIOD; ++i)
+      if (pRows[r - i]) return 0;
+   for (; i <= 2 * PERIOD; ++i)
+      if (causesBirth[pRows[r - i]]) return 0;
+   return 1;
+}
+
+/* Hash of the state ending at pRows[r], for the tables of iddfsNode(). */
+/* Flipped states hash the same with asymmetric searches.              */
+static inline uint32_t stateHash(row *pRows, uint32_t r){
+   uint32_t h = 0;
+   int i;
+   for (i = 0; i < 2 * PERIOD; ++i){
+      h = h * 269 + pRows[r - i];
+      if (params[P_SYMMETRY] == SYM_ASYM) h += flip[pRows[r - i]];
+   }
+   return h + (h >> 16) * 269;
+}
+
+/* Test whether the 2*period rows ending at a and b are the same state */
+static inline int sameState(const row *a, const row *b){
+   int i;
+   for (i = 0; i < 2 * PERIOD && a[-i] == b[-i]; ++i);
+   if (i == 2 * PERIOD) return 1;
+   if (params[P_SYMMETRY] != SYM_ASYM) return 0;
+   for (i = 0; i < 2 * PERIOD && a[-i] == flip[b[-i]]; ++i);
+   return i == 2 * PERIOD;
+}
+
+/* Test whether the state ending at pRows[r], at the given depth, needs no */
+/* search, as the hash table of the breadth-first search would.  That is   */
+/* so if it is on the path already, if the queue has it, or if it was      */
+/* searched at a smaller depth, or at the same depth in this pass; this    */
+/* pass searches the first of those again.  Otherwise the state is         */
+/* recorded as searched.  A state repeated along a path would let the      */
+/* bound grow forever, and a state found deeper than before would give     */
+/* longer copies of the same spaceships.                                   */
+static int seenState(row *pRows, uint32_t r, uint32_t depth, iddfsTables *t){
+   uint32_t h = stateHash(pRows, r);
+   uint32_t s;
+   row *e;
+   for (s = t->pathHead[h & (PATHHASHSIZE - 1)]; s; s = t->pathNext[s])
+      if (sameState(pRows + s, pRows + r)) return 1;
+   if (rowsVisited(pRows, r)) return 1;
+   h &= SEENSIZE - 1;
+   e = t->rows + (size_t)(h + 1) * 2 * PERIOD - 1;
+   if (t->depth[h] && sameState(e, pRows + r)){
+      if (t->depth[h] < depth || (t->depth[h] == depth && t->pass[h] == t->thisPass)) return 1;
+   }
+   else
+      memcpy(e - 2 * PERIOD + 1, pRows + r - 2 * PERIOD + 1, 2 * PERIOD * sizeof(row));
+   t->depth[h] = depth;
+   t->pass[h] = t->thisPass;
+   return 0;
+}
+
+/* Add the state ending at pRows[r] to the path, or remove it once the */
+/* search backs up past it.  States leave in the order they came.      */
+static inline void pathPush(row *pRows, uint32_t r, iddfsTables *t){
+   uint32_t h = stateHash(pRows, r) & (PATHHASHSIZE - 1);
+   t->pathNext[r] = t->pathHead[h];
+   t->pathHead[h] = r;
+}
+
+static inline void pathPop(row *pRows, uint32_t r, iddfsTables *t){
+   t->pathHead[stateHash(pRows, r) & (PATHHASHSIZE - 1)] = t->pathNext[r];
+}
+
+/* One pass of iterative deepening below queue node root: try every path   */
+/* of up to bound rows, printing the spaceships of more than prevBound rows. */
+/* Returns 0 if no path reaches bound rows and 1 otherwise.  Returns 2 if    */
+/* *pause was set, with the path to the level being started saved as the    */
+/* extension of root.  t holds the states seen by this thread.              */
+int iddfsNode(node root, uint32_t bound, uint32_t prevBound, uint16_t **pInd, int *pRemain, row *pRows,
+              iddfsTables *t, _Atomic int *pause){
+   uint32_t startRow = 2*PERIOD + 1;
+   uint32_t currRow = startRow;
+   int pPhase = peekPhase(root);
+   int reached = 0, i;
+   unsigned int steps = 0;
+   node x = root;
+   uint32_t rootDepth = nodeDepth(root);
+#ifndef QSIMPLE
+   uint32_t pruneRow = pruneRowBelow(root, startRow);
+#endif
+   
+   for (i = currRow - 1; i >= 0; --i){
+      pRows[i] = ROW(x);
+      x = PARENT(x);
+   }
+   ++pPhase;
+   if (pPhase == period) pPhase = 0;
+   
+   /* Resume a search stopped for a dump.  Whether it had reached the */
+   /* bound is not recorded, so assume that it had.                   */
+   uint32_t theDeepIndex = deepRowIndices[deepQHead + root - qHead];
+   deepRowIndices[deepQHead + root - qHead] = 0;
+   if (theDeepIndex > 1){
+      row *e = deepRows[theDeepIndex];
+      if ( e[EXT_LEFT] < bound
+           && extCheck(e) == rowCheck(pRows + startRow - 2*PERIOD)
+           && !reloadDepthFirst((uint16_t)startRow, pPhase, (uint16_t)bound, e, pInd, pRemain, pRows) ){
+         currRow = startRow + e[EXT_LEFT];
+         pPhase = (pPhase + currRow - startRow) % period;
+         reached = 1;
+      }
+      freeDeepIndex(theDeepIndex);
+   }
+   
+   memset(t->pathHead, 0, PATHHASHSIZE * sizeof(*t->pathHead));
+   for (i = startRow - 1; i < (int)currRow; ++i)
+      pathPush(pRows, i, t);
+   
+   getoffsetcount(pRows[currRow - 2 * PERIOD],
+                  pRows[currRow - PERIOD],
+                  pRows[currRow - PERIOD + BACKOFF(pPhase)],
+                  &(pInd[currRow]), &(pRemain[currRow]));
+   orderBranches(pRows, currRow, pPhase, &(pInd[currRow]), pRemain[currRow]);
    pInd[currRow] += pRemain[currRow];
    
-   int earlyExit = MIN(params[P_NUMTHREADS], (int) (qTail - qHead)/4);
    for (;;){
       /* Back up if there are no rows left to check at this depth */
       if (!pRemain[currRow]){
+         if (currRow == startRow) return reached;
+         pathPop(pRows, currRow - 1, t);
          --currRow;
-#ifndef QSIMPLE   /* The value of pPhase doesn't matter for QSIMPLE, so avoid calculating it in the main loop. */
          if (pPhase == 0) pPhase = period;
          --pPhase;
-#endif
-         if (currRow < startRow) return 0;
-         
          continue;
       }
       
-      /* Check next row with fixed-depth look ahead and add it if it passes */
       pRows[currRow] = *(pInd[currRow] - pRemain[currRow]);
       --pRemain[currRow];
       if (!lookAhead(pRows, currRow, pPhase))
          continue;
       
       ++currRow;
-#ifndef QSIMPLE   /* The value of pPhase doesn't matter for QSIMPLE, so avoid calculating it in the main loop. */
       ++pPhase;
       if (pPhase == period) pPhase = 0;
-#endif
       
-      /* Test for early exit conditions */
-      if ( atomic_load_explicit(forceExit, memory_order_relaxed)
-           || (   params[P_EARLYEXIT]
-               && atomic_load_explicit(remainingItems, memory_order_relaxed) < earlyExit
-               && atomic_load_explicit(passed, memory_order_relaxed) ) )
-         {
-         deepRowIndices[deepQHead + theNode - qHead] = 1;   /* flag as success without saving extension rows */
-         int earlyExitHowDeep = currRow - startRow - 1;
-         if (earlyExitHowDeep >= params[P_MINEXTENSION])
-            saveDepthFirst(theNode, startRow, earlyExitHowDeep, pRows);
-         return 1;
+#ifndef QSIMPLE
+      if (currRow - 1 == pruneRow && subperiodic(root, pRows, startRow - 1, currRow - 1)){
+         atomic_fetch_add_explicit(&subperiodCuts[1], 1, memory_order_relaxed);
+         --currRow;
+         if (pPhase == 0) pPhase = period;
+         --pPhase;
+         continue;
       }
+#endif
       
-      /* Check if we reached the desired depth. If so,  
-         check if the result is a complete spaceship */
-      if (currRow > startRow + howDeep){
-         /* Increment successful depth-first counter (used in early exit check) */
-         atomic_fetch_add_explicit(passed, 1, memory_order_relaxed);
-
-         /* Flag that an extension was found. This value will be changed by saveDepthFirst() */
-         deepRowIndices[deepQHead + theNode - qHead] = 1;
-         
-         /* Save the extension if it is long enough */
-         if (howDeep >= params[P_MINEXTENSION]){
-            saveDepthFirst(theNode, startRow, howDeep, pRows);
-         }
-         
-         /* Check if the extension represents a spaceship */
-         if (params[P_PRINTDEEP] == 0) return 1;
-         for (i = 1; i <= PERIOD; ++i){
-            if (pRows[currRow - i]) return 1;
-         }
-         currRow -= PERIOD;
-         for (i = 1; i <= PERIOD; ++i){
-            if (causesBirth[pRows[currRow - i]]) return 1;
+      /* Report a spaceship when its last row is added, as process() does, */
+      /* and keep going since rows behind it may grow a second object.     */
+      /* Once all 2*period rows are empty only empty rows can follow.      */
+      if (shipEnds(pRows, currRow)){
+         for (i = PERIOD + 1; i <= 2 * PERIOD && !pRows[currRow - i]; ++i);
+         if (i > 2 * PERIOD){
+            --currRow;
+            if (pPhase == 0) pPhase = period;
+            --pPhase;
+            continue;
          }
-         
-         /* If we got here, then we found a spaceship! */
-         #pragma omp critical(printWhileDeepening)
-         {
-            success(theNode, pRows, startRow - 1, currRow + PERIOD - 1);
+         if (currRow - startRow > prevBound && !shipEnds(pRows, currRow - 1)){
+            int known = 0;
+            #pragma omp critical(printWhileDeepening)
+            {
+               if (!aborting) known = success(root, pRows, startRow - 1, currRow - 1);
+            }
+            if (aborting) return 1;
+            if (known){    /* don't search behind a known spaceship */
+               --currRow;
+               if (pPhase == 0) pPhase = period;
+               --pPhase;
+               continue;
+            }
          }
-         if (aborting)  /* Flag for early exit if the desired number of ships has been found */
-            atomic_store_explicit(forceExit, 1, memory_order_seq_cst);
-         return 1;
       }
       
-      /* Get the list of successor rows based on the newly added row */
+      /* Back up at a repeated state or at the bound */
+      if (seenState(pRows, currRow - 1, rootDepth + currRow - startRow, t)){
+         --currRow;
+         if (pPhase == 0) pPhase = period;
+         --pPhase;
+         continue;
+      }
+      if (currRow - startRow == bound){
+         reached = 1;
+         --currRow;
+         if (pPhase == 0) pPhase = period;
+         --pPhase;
+         continue;
+      }
+      
       getoffsetcount(pRows[currRow - 2 * PERIOD],
                      pRows[currRow - PERIOD],
                      pRows[currRow - PERIOD + BACKOFF(pPhase)],
                      &(pInd[currRow]), &(pRemain[currRow]));
+      orderBranches(pRows, currRow, pPhase, &(pInd[currRow]), pRemain[currRow]);
       pInd[currRow] += pRemain[currRow];
+      pathPush(pRows, currRow - 1, t);
+      
+      /* Nothing at this level has been tried yet, so the rows before it */
+      /* are exactly what is needed to resume the search later.          */
+      if (!(++steps & 0xfffff) && iddfsDumpDue())
+         atomic_store_explicit(pause, 1, memory_order_relaxed);
+      if (atomic_load_explicit(pause, memory_order_relaxed)){
+         saveDepthFirst(root, startRow, currRow - startRow - 1, pRows, 0);
+         return 2;
+      }
    }
 }
 
+/* Expand record i of generation gen, whose nodes have the given depth. */
+/* Returns the number of children added to out.                        */
+int extExpand(const unsigned char *rec, uint32_t i, int gen, int depth,
+              uint16_t **pInd, int *pRemain, row *pRows, extBuffer *out) {
+   uint32_t currRow = 2 * period + 1;
+   int pPhase = (DEPTHPHASE(depth) + 1) % period;
+   uint16_t *riStart;
+   int numRows, j, k, added = 0;
+   _Atomic int stop = 0;
+   
+   memcpy(pRows, rec, extRowsSize);
+   if (!probeRows(currRow, pPhase, MINDEEP, pInd, pRemain, pRows, &stop)) return 0;
+   
+   getoffsetcount( pRows[currRow - 2 * PERIOD],
+                   pRows[currRow - PERIOD],
+                   pRows[currRow - PERIOD + BACKOFF(pPhase)],
+                   &riStart,
+                   &numRows );
+   for (j = 0; j < numRows; ++j){
+      pRows[currRow] = riStart[j];
+      if (!lookAhead(pRows, currRow, pPhase)) continue;
+      
+      /* skip the empty state of the search root */
+      for (k = 2; k <= (int)currRow && !pRows[k]; ++k);
+      if (k > (int)currRow) continue;
+      
+      /* as in process(), the search goes on behind a spaceship */
+      if (extTerminal(pRows + 2) && !extTerminal(pRows + 1)){
+         int known = 0;
+         #pragma omp critical(printWhileDeepening)
+         {
+            if (!aborting) known = extSuccess(gen, i, pRows[currRow]);
+         }
+         if (known) continue;    /* don't search behind a known spaceship */
+      }
+      
+      if (out->n == out->cap) extFlush(out);
+      unsigned char *child = out->data + out->n++ * extRecSize;
+      memcpy(child, pRows + 1, extRowsSize);
+      memcpy(child + extRowsSize, &i, sizeof(i));
+      ++added;
+   }
+   return added;
+}
+
 int main(int argc, char *argv[]){
    printf("%s\n",BANNER);
    
@@ -653,5 +1254,5 @@ int main(int argc, char *argv[]){
    
    finalReport();
    
-   return 0;
+   return aborting == 4;
 }